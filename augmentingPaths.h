@@ -0,0 +1,129 @@
+#ifndef AUGMENTING_PATHS_H
+#define AUGMENTING_PATHS_H
+
+#include <vector>
+#include <algorithm>
+
+#include "gridGraph.h"
+#include "instrumentation.h"
+
+// Edmonds-Karp max-flow between two pixels of a GridGraph: flow is pushed along shortest augmenting paths found by BFS until the
+// sink cannot be reached. With capacity scaling only arcs with a residual of at least maxCapacity are used, and maxCapacity is halved
+// whenever no such path is left, so the first paths carry most of the flow.
+//
+// Every BFS runs in a workspace allocated with the solver: the parent and visited arrays and the queue, one entry per pixel (a
+// pixel is queued at most once per search, so the queue never wraps). A pixel is visited when its stamp equals the generation of
+// the current search, so starting a search clears nothing, and the augmentation loop allocates no memory.
+
+template <typename capType>
+class AugmentingPaths
+{
+public:
+	typedef GridGraph<capType> graphType;
+	typedef typename graphType::traits traits;
+	typedef typename graphType::valueType valueType;
+
+	int augmentations; // number of augmenting paths
+
+	AugmentingPaths(graphType* graph, int s, int t) : augmentations(0), graph(graph), s(s), t(t), parent(graph->size(), -1),
+		visited(graph->size(), 0), generation(0), queue(graph->size()) {}
+
+	void maxflow() // normal approach without capacity scaling
+	{
+		while(bfs()) // while there is a path from source to target (bfs funciton populates "parent")
+		{
+			augmentations++;
+			augment();
+		}
+	}
+
+	void scalingMaxflow(int maxCapacity) // capacity scaling approach, maxCapacity: largest arc capacity
+	{
+		while(maxCapacity >= 1)
+		{
+			while(bfs(maxCapacity)) // while there is a path from source to target with residual capacity of at least "maxCapacity"
+			{
+				augmentations++;
+				augment();
+			}
+
+			maxCapacity /= 2;
+		}
+	}
+
+private:
+	graphType* graph;
+	int s, t;
+	std::vector<int> parent; // parent of every pixel in the path found using BFS
+	std::vector<unsigned> visited; // generation of the last search that reached the pixel
+	unsigned generation;
+	std::vector<int> queue; // pixels in the order the search reached them
+
+	bool bfs(int maxCapacity = 0)
+	{
+		if(++generation == 0) // the stamps wrapped around: older searches could look current
+		{
+			std::fill(visited.begin(), visited.end(), 0);
+			generation = 1;
+		}
+
+		int head = 0, tail = 0;
+		queue[tail++] = s;
+		visited[s] = generation;
+		parent[s] = -1;
+
+		while(head < tail && visited[t] != generation)
+		{
+			int temp = queue[head++];
+			INSTRUMENT_COUNT(COUNTER_BFS_NODES, 1);
+
+			for(int d = 0; d < GridLayout::NUM_ARCS; d++) // iterate through neighbours of the node
+			{
+				valueType weight = graph->residual(temp, d);
+				if(traits::positive(weight) && weight >= maxCapacity) // if positive residual weight and neighbour has not been visited, enqueue, mark visited as true and mark parent
+				{
+					int adj = graph->neighbour(temp, d);
+					if(visited[adj] != generation)
+					{
+						queue[tail++] = adj;
+						visited[adj] = generation;
+						parent[adj] = temp;
+					}
+				}
+			}
+		}
+
+		return visited[t] == generation;
+	}
+
+	valueType augment()
+	{
+		INSTRUMENT_COUNT(COUNTER_AUGMENTING_PATHS, 1);
+
+		valueType flow = traits::infinity();
+		int foo = t;
+		while(foo != s) // calculating minimum of all weights in the path; equivalent to finding minimum/bottleneck capacity in the chosen path
+		{
+			INSTRUMENT_COUNT(COUNTER_PATH_LENGTH, 1);
+			int fooParent = parent[foo];
+			valueType edgeWeight = graph->residual(fooParent, graph->arcTo(fooParent, foo));
+			if(flow > edgeWeight)
+			{
+				flow = edgeWeight;
+			}
+			foo = fooParent;
+		}
+
+		foo = t;
+		while(foo != s) // push "flow" along the path; the reverse arcs gain the same residual capacity
+		{
+			int fooParent = parent[foo];
+			graph->push(fooParent, graph->arcTo(fooParent, foo), flow);
+			foo = fooParent;
+		}
+
+		return flow;
+	}
+};
+
+#endif
@@ -0,0 +1,119 @@
+#ifndef BAND_GRAPH_H
+#define BAND_GRAPH_H
+
+#include <vector>
+#include <algorithm>
+
+#include "gridGraph.h"
+
+// Residual network over a narrow band of pixels of a grid, e.g. the pixels near the boundary of an upsampled segmentation.
+// Only band pixels are nodes, numbered row by row in increasing column order, so memory is proportional to the band and not to the image.
+// East/west neighbours are the next/previous node; north/south neighbours are stored. Arcs to pixels outside the band do not exist:
+// the caller folds them into the terminal links. Same interface as GridGraph, so BKMaxflow runs on it unchanged.
+
+template <typename capType>
+class BandGraph
+{
+public:
+	typedef capacityTraits<capType> traits;
+	typedef typename traits::flowType flowType;
+	typedef typename traits::valueType valueType;
+
+	int rows, cols;
+
+	std::vector<int> rowStart; // the nodes of row y are rowStart[y] .. rowStart[y + 1] - 1
+	std::vector<int> column; // column of every node
+	std::vector<capType> capacity[GridLayout::NUM_ARCS]; // 0 if the neighbour is outside the band
+	std::vector<flowType> flow[GridLayout::NUM_ARCS];
+	std::vector<valueType> terminal;
+
+	BandGraph(int cols) : rows(0), cols(cols)
+	{
+		rowStart.push_back(0);
+	}
+
+	void addRow(const std::vector<int>& columns) // band pixels of the next row, in increasing column order
+	{
+		int above = rows > 0 ? rowStart[rows - 1] : 0, aboveEnd = rowStart[rows];
+
+		for(size_t k = 0; k < columns.size(); k++)
+		{
+			int v = size();
+			column.push_back(columns[k]);
+			up.push_back(-1);
+			down.push_back(-1);
+			for(int d = 0; d < GridLayout::NUM_ARCS; d++)
+			{
+				capacity[d].push_back(0);
+				flow[d].push_back(0);
+			}
+			terminal.push_back(0);
+
+			while(above < aboveEnd && column[above] < columns[k]) // both rows are sorted: merge
+			{
+				above++;
+			}
+			if(above < aboveEnd && column[above] == columns[k])
+			{
+				up[v] = above;
+				down[above] = v;
+			}
+		}
+
+		rows++;
+		rowStart.push_back(size());
+	}
+
+	int size() const
+	{
+		return (int)column.size();
+	}
+
+	int find(int x, int y) const // node of pixel (x, y), -1 if it is not in the band
+	{
+		std::vector<int>::const_iterator begin = column.begin() + rowStart[y], end = column.begin() + rowStart[y + 1];
+		std::vector<int>::const_iterator it = std::lower_bound(begin, end, x);
+		return it != end && *it == x ? (int)(it - column.begin()) : -1;
+	}
+
+	int neighbour(int v, int d) const // only valid for arcs inside the band
+	{
+		return d == GridLayout::ARC_N ? up[v] : d == GridLayout::ARC_S ? down[v] : d == GridLayout::ARC_E ? v + 1 : v - 1;
+	}
+
+	bool hasArc(int v, int d) const
+	{
+		return capacity[d][v] > 0;
+	}
+
+	valueType residual(int v, int d) const
+	{
+		return (valueType)capacity[d][v] - flow[d][v];
+	}
+
+	bool unsaturated(int v, int d) const
+	{
+		return traits::positive(residual(v, d));
+	}
+
+	valueType netOutflow(int v) const
+	{
+		valueType outflow = 0;
+		for(int d = 0; d < GridLayout::NUM_ARCS; d++)
+		{
+			outflow += flow[d][v];
+		}
+		return outflow;
+	}
+
+	void push(int v, int d, valueType amount)
+	{
+		flow[d][v] += (flowType)amount;
+		flow[GridLayout::reverse(d)][neighbour(v, d)] -= (flowType)amount;
+	}
+
+private:
+	std::vector<int> up, down; // north/south neighbour, -1 outside the band
+};
+
+#endif
@@ -0,0 +1,222 @@
+#ifndef BATCH_PIPELINE_H
+#define BATCH_PIPELINE_H
+
+#include <vector>
+#include <deque>
+#include <string>
+#include <fstream>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+#include <ctype.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+// Headless processing of many images: decode, segment and encode run as three stages connected by bounded queues, so while
+// one image is segmented the next ones are decoded and the previous ones encoded. Each stage has its own threads and a queue holds
+// at most as many images as there are segmentation threads, so the number of images in memory stays bounded however long the list is.
+// The images are independent: every image is segmented on one thread and throughput grows with the number of threads.
+
+template <typename item>
+class BoundedQueue
+{
+public:
+	BoundedQueue(size_t capacity) : capacity(std::max(capacity, (size_t)1)), producers(0) {}
+
+	void addProducer()
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		producers++;
+	}
+
+	void removeProducer() // the queue is closed when its last producer is done
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		producers--;
+		changed.notify_all();
+	}
+
+	void push(item value)
+	{
+		std::unique_lock<std::mutex> guard(lock);
+		changed.wait(guard, [&]{ return items.size() < capacity; });
+		items.push_back(std::move(value));
+		changed.notify_all();
+	}
+
+	bool pop(item* value) // false once the queue is closed and empty
+	{
+		std::unique_lock<std::mutex> guard(lock);
+		changed.wait(guard, [&]{ return !items.empty() || producers == 0; });
+		if(items.empty())
+		{
+			return false;
+		}
+		*value = std::move(items.front());
+		items.pop_front();
+		changed.notify_all();
+		return true;
+	}
+
+private:
+	size_t capacity;
+	int producers;
+	std::deque<item> items;
+	std::mutex lock;
+	std::condition_variable changed;
+};
+
+class BatchPipeline
+{
+public:
+	// job: default constructible and movable. decode(path, job*) and encode(job*) return false on failure, segment(job*) cannot fail.
+	// Returns the number of images that could not be decoded or encoded.
+	template <typename job, typename decodeFunction, typename segmentFunction, typename encodeFunction>
+	static int run(const std::vector<std::string>& paths, int threads, decodeFunction decode, segmentFunction segment, encodeFunction encode)
+	{
+		threads = std::max(threads, 1);
+		int coders = std::max(1, threads / 4); // decoding and encoding are a small part of the work
+		BoundedQueue<job> decoded(threads), segmented(threads);
+		std::mutex lock;
+		size_t next = 0;
+		int failures = 0;
+
+		auto fail = [&]()
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			failures++;
+		};
+
+		for(int k = 0; k < coders; k++) // before any thread starts, so that no queue looks closed too early
+		{
+			decoded.addProducer();
+		}
+		for(int k = 0; k < threads; k++)
+		{
+			segmented.addProducer();
+		}
+
+		std::vector<std::thread> workers;
+		for(int k = 0; k < coders; k++)
+		{
+			workers.push_back(std::thread([&]()
+			{
+				while(true)
+				{
+					size_t i;
+					{
+						std::lock_guard<std::mutex> guard(lock);
+						i = next++;
+					}
+					if(i >= paths.size())
+					{
+						break;
+					}
+					job current;
+					if(decode(paths[i], &current))
+					{
+						decoded.push(std::move(current));
+					}
+					else
+					{
+						fail();
+					}
+				}
+				decoded.removeProducer();
+			}));
+		}
+		for(int k = 0; k < threads; k++)
+		{
+			workers.push_back(std::thread([&]()
+			{
+				job current;
+				while(decoded.pop(&current))
+				{
+					segment(&current);
+					segmented.push(std::move(current));
+				}
+				segmented.removeProducer();
+			}));
+		}
+		for(int k = 0; k < coders; k++)
+		{
+			workers.push_back(std::thread([&]()
+			{
+				job current;
+				while(segmented.pop(&current))
+				{
+					if(!encode(&current))
+					{
+						fail();
+					}
+				}
+			}));
+		}
+
+		for(size_t k = 0; k < workers.size(); k++)
+		{
+			workers[k].join();
+		}
+		return failures;
+	}
+
+	// images of a directory (by extension), or the paths listed one per line in a text file. Outputs of earlier runs are named
+	// "<image path>.<suffix>.png" and skipped: a name with an image extension before its last one is not an input.
+	static bool listImages(const std::string& input, std::vector<std::string>* paths)
+	{
+		struct stat info;
+		if(stat(input.c_str(), &info) != 0)
+		{
+			return false;
+		}
+
+		if(!S_ISDIR(info.st_mode))
+		{
+			std::ifstream list(input.c_str());
+			std::string line;
+			while(std::getline(list, line))
+			{
+				if(!line.empty() && line[0] != '#')
+				{
+					paths->push_back(line);
+				}
+			}
+			return true;
+		}
+
+		DIR* directory = opendir(input.c_str());
+		if(directory == NULL)
+		{
+			return false;
+		}
+		static const char* extensions[] = {".png", ".jpg", ".jpeg", ".bmp", ".pgm", ".ppm", ".pnm", ".tif", ".tiff", ".raw"};
+		std::string folder = input[input.size() - 1] == '/' ? input : input + "/";
+		for(struct dirent* entry = readdir(directory); entry != NULL; entry = readdir(directory))
+		{
+			std::string name(entry->d_name);
+			std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+			size_t dot = name.rfind('.');
+			if(dot == std::string::npos)
+			{
+				continue;
+			}
+
+			bool image = false, output = false;
+			for(size_t k = 0; k < sizeof(extensions) / sizeof(extensions[0]); k++)
+			{
+				image = image || name.substr(dot) == extensions[k];
+				output = output || name.find(std::string(extensions[k]) + ".") != std::string::npos;
+			}
+			if(image && !output)
+			{
+				paths->push_back(folder + entry->d_name);
+			}
+		}
+		closedir(directory);
+		std::sort(paths->begin(), paths->end());
+		return true;
+	}
+};
+
+#endif
@@ -0,0 +1,679 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <random>
+#include <atomic>
+#include <new>
+#include <algorithm>
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+#include "weightModels.h"
+#include "gridGraph.h"
+#include "augmentingPaths.h"
+#include "bkMaxflow.h"
+#include "pushRelabel.h"
+#include "blockLabelling.h"
+#include "concurrentRegionGrowing.h"
+#include "mstSegmentation.h"
+
+using namespace std;
+
+// Headless benchmark of the solvers on synthetic images: no OpenCV, no windows, no clicks. Every run is a forked child, so its
+// peak resident set (which includes the input image) is measured on its own and a solver that runs out of memory only loses its row.
+// The heap allocations of a run are counted as well: a solver whose count grows with its work (e.g. per augmenting path) allocates
+// in its inner loop.
+
+typedef capacityFor<intensityWeight>::type capType;
+typedef GridGraph<capType> graphType;
+typedef graphType::valueType valueType;
+
+const int ADJACENCY_RANGE = 10; // as in ccl
+const int SEED_RANGE = 50;
+const int GROW_SEEDS = 16;
+const int THRESHOLD = 128;
+
+enum benchCase
+{
+	CCL_BLOCKS = 0, CCL_GROW, MST_GRAY, MST_RGB, MST_HIERARCHY, MINCUT_PATHS, MINCUT_SCALING, MINCUT_BK, MINCUT_PUSH_RELABEL, NUM_CASES
+};
+
+struct caseInfo
+{
+	const char* tool;
+	const char* mode;
+	const char* unit; // what the work count counts
+	bool threaded; // run for every thread count, otherwise once on one thread
+};
+
+const caseInfo cases[NUM_CASES] =
+{
+	{"ccl", "blocks", "pixels", true},
+	{"ccl", "parallel", "pixels", true},
+	{"mst", "gray", "edges", true},
+	{"mst", "rgb", "edges", true},
+	{"mst", "hierarchy", "edges", true},
+	{"minCut", "0", "augmentations", false},
+	{"minCut", "1", "augmentations", false},
+	{"minCut", "2", "augmentations", false},
+	{"minCut", "3", "pushes", true}
+};
+
+struct benchImage // interleaved B G R (3 cols bytes per row) and the gray image (cols bytes per row)
+{
+	int rows, cols;
+	vector<unsigned char> bgr;
+	vector<unsigned char> gray;
+};
+
+struct benchResult
+{
+	int c, threads;
+	double megapixels, seconds, speedup;
+	long peakKb;
+	long long work;
+	long long allocations; // operator new calls of the run
+};
+
+atomic<long long> heapAllocations(0); // operator new calls of the process, counted by the replacement below
+
+__attribute__((noinline)) void* operator new(size_t size)
+{
+	heapAllocations.fetch_add(1, memory_order_relaxed);
+	void* block = malloc(size ? size : 1);
+	if(block == NULL)
+	{
+		throw bad_alloc();
+	}
+	return block;
+}
+
+__attribute__((noinline)) void operator delete(void* block) noexcept // not inlined into the containers, where free() would look mismatched
+{
+	free(block);
+}
+
+void makeImage(double, int, int, unsigned, benchImage*);
+bool measure(int, const benchImage&, int, benchResult*);
+long long runCase(int, const benchImage&, int);
+long long mstCase(int, const benchImage&, int);
+long long minCutCase(int, const benchImage&, int);
+void seedGraph(const benchImage&, graphType*, int*, int*);
+int runCheck(const string&, unsigned);
+bool checkDynamicCuts(unsigned, int);
+bool checkAllocations(unsigned);
+void sourceSide(const graphType&, vector<bool>*);
+vector<double> parseList(const string&);
+void writeCsv(ostream&, const vector<benchResult>&);
+void writeJson(ostream&, const vector<benchResult>&);
+
+int main(int argc, char** argv)
+{
+	vector<double> sizes = parseList("0.25,1,4,16,50"); // megapixels
+	vector<double> threadCounts = parseList("1,2,4");
+	int regions = 64, noise = 8;
+	unsigned seed = 1;
+	double pathsLimit = 0.25; // the augmenting path solvers take one BFS over the image per path: only run them up to this size
+	string csvPath, jsonPath, check;
+
+	for(int a = 1; a < argc; a++)
+	{
+		string arg(argv[a]);
+		size_t eq = arg.find('=');
+		string key = arg.substr(0, eq), value = eq == string::npos ? "" : arg.substr(eq + 1);
+		if(key == "sizes")
+		{
+			sizes = parseList(value);
+		}
+		else if(key == "threads")
+		{
+			threadCounts = parseList(value);
+		}
+		else if(key == "regions")
+		{
+			regions = max(atoi(value.c_str()), 1);
+		}
+		else if(key == "noise")
+		{
+			noise = max(atoi(value.c_str()), 0);
+		}
+		else if(key == "seed")
+		{
+			seed = (unsigned)atoi(value.c_str());
+		}
+		else if(key == "paths")
+		{
+			pathsLimit = atof(value.c_str());
+		}
+		else if(key == "csv")
+		{
+			csvPath = value;
+		}
+		else if(key == "json")
+		{
+			jsonPath = value;
+		}
+		else if(key == "check")
+		{
+			check = value;
+		}
+		else
+		{
+			cout << "Usage : ./benchmark [sizes=0.25,1,4,16,50] [threads=1,2,4] [regions=64] [noise=8] [seed=1] [paths=0.25] [csv=<path>] [json=<path>] [check=dynamic|allocations]" << endl;
+			return 0;
+		}
+	}
+
+	if(!check.empty())
+	{
+		return runCheck(check, seed);
+	}
+
+	vector<benchResult> results;
+	writeCsv(cout, results); // header; rows follow as they are measured
+
+	for(size_t s = 0; s < sizes.size(); s++)
+	{
+		benchImage image;
+		makeImage(sizes[s], regions, noise, seed, &image);
+
+		for(int c = 0; c < NUM_CASES; c++)
+		{
+			if((c == MINCUT_PATHS || c == MINCUT_SCALING) && sizes[s] > pathsLimit)
+			{
+				continue;
+			}
+
+			double baseline = 0; // wall time of the first thread count
+			for(size_t k = 0; k < threadCounts.size(); k++)
+			{
+				int threads = cases[c].threaded ? max((int)threadCounts[k], 1) : 1;
+				if(!cases[c].threaded && k > 0)
+				{
+					break;
+				}
+
+				benchResult result;
+				result.megapixels = sizes[s];
+				if(!measure(c, image, threads, &result))
+				{
+					cerr << cases[c].tool << " " << cases[c].mode << " failed at " << sizes[s] << " MP, " << threads << " threads" << endl;
+					continue;
+				}
+				if(baseline == 0)
+				{
+					baseline = result.seconds;
+				}
+				result.speedup = result.seconds > 0 ? baseline / result.seconds : 0;
+
+				results.push_back(result);
+				writeCsv(cout, vector<benchResult>(1, result));
+			}
+		}
+	}
+
+	if(!csvPath.empty())
+	{
+		ofstream csv(csvPath.c_str());
+		writeCsv(csv, vector<benchResult>());
+		if(!results.empty())
+		{
+			writeCsv(csv, results);
+		}
+	}
+	if(!jsonPath.empty())
+	{
+		ofstream json(jsonPath.c_str());
+		writeJson(json, results);
+	}
+
+	return 0;
+}
+
+// synthetic image: a grid of regions with wavy borders, each of one random colour, plus uniform noise of +-noise per channel.
+// The borders give the labelling, the segmentation and the cuts structure to follow and the noise keeps the edge weights varied.
+
+void makeImage(double megapixels, int regions, int noise, unsigned seed, benchImage* image)
+{
+	long long pixels = max((long long)(megapixels * 1e6), 1LL);
+	int cols = max((int)sqrt(pixels * 4.0 / 3), 1); // 4:3
+	int rows = max((int)(pixels / cols), 1);
+	image->rows = rows;
+	image->cols = cols;
+
+	int cellsX = max((int)sqrt(regions * 4.0 / 3), 1), cellsY = max(regions / cellsX, 1);
+	double cellW = (double)cols / cellsX, cellH = (double)rows / cellsY;
+
+	mt19937 random(seed);
+	vector<unsigned char> colours(cellsX * cellsY * 3);
+	for(size_t k = 0; k < colours.size(); k++)
+	{
+		colours[k] = (unsigned char)(random() & 255);
+	}
+
+	image->bgr.resize((size_t)rows * cols * 3);
+	image->gray.resize((size_t)rows * cols);
+
+	vector<int> shift(max(rows, cols)); // border displacement along a row or column
+	for(size_t k = 0; k < shift.size(); k++)
+	{
+		shift[k] = (int)(0.25 * min(cellW, cellH) * sin(k * 6.2832 / (4 * min(cellW, cellH))));
+	}
+
+	for(int y = 0; y < rows; y++)
+	{
+		for(int x = 0; x < cols; x++)
+		{
+			int cx = min(max((int)((x + shift[y]) / cellW), 0), cellsX - 1);
+			int cy = min(max((int)((y + shift[x]) / cellH), 0), cellsY - 1);
+			const unsigned char* colour = &colours[(cy * cellsX + cx) * 3];
+			size_t p = (size_t)y * cols + x;
+			unsigned char* pixel = &image->bgr[3 * p];
+
+			unsigned int bits = random();
+			for(int c = 0; c < 3; c++)
+			{
+				int n = noise > 0 ? (int)((bits >> (8 * c)) & 255) * (2 * noise + 1) / 256 - noise : 0;
+				pixel[c] = (unsigned char)min(max(colour[c] + n, 0), 255);
+			}
+			image->gray[p] = (unsigned char)((pixel[0] * 29 + pixel[1] * 150 + pixel[2] * 77 + 128) >> 8);
+		}
+	}
+}
+
+// runs one case in a child process; the child reports its wall time, work count and heap allocations through a pipe and the parent
+// reads its peak RSS
+
+bool measure(int c, const benchImage& image, int threads, benchResult* result)
+{
+	result->c = c;
+	result->threads = threads;
+
+	int channel[2];
+	if(pipe(channel) != 0)
+	{
+		return false;
+	}
+
+	cout.flush();
+	pid_t child = fork();
+	if(child < 0)
+	{
+		close(channel[0]);
+		close(channel[1]);
+		return false;
+	}
+
+	if(child == 0)
+	{
+		close(channel[0]);
+		long long allocated = heapAllocations.load();
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		long long work = runCase(c, image, threads);
+		double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+		allocated = heapAllocations.load() - allocated;
+
+		char message[96];
+		int length = snprintf(message, sizeof(message), "%.6f %lld %lld", seconds, work, allocated);
+		_exit(write(channel[1], message, length) == length ? 0 : 1);
+	}
+
+	close(channel[1]);
+	string message;
+	char buffer[64];
+	ssize_t length;
+	while((length = read(channel[0], buffer, sizeof(buffer))) > 0)
+	{
+		message.append(buffer, length);
+	}
+	close(channel[0]);
+
+	int status;
+	struct rusage usage;
+	if(wait4(child, &status, 0, &usage) != child || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+	{
+		return false;
+	}
+
+	result->peakKb = usage.ru_maxrss; // kilobytes on Linux
+	istringstream in(message);
+	return (bool)(in >> result->seconds >> result->work >> result->allocations);
+}
+
+long long runCase(int c, const benchImage& image, int threads)
+{
+	int rows = image.rows, cols = image.cols;
+
+	if(c == CCL_BLOCKS)
+	{
+		vector<unsigned char> mask(image.gray.size());
+		for(size_t p = 0; p < mask.size(); p++)
+		{
+			mask[p] = image.gray[p] > THRESHOLD ? 255 : 0;
+		}
+		vector<int> labels(mask.size());
+		BlockLabelling::label(mask.data(), cols, rows, cols, labels.data(), cols, threads);
+		return (long long)rows * cols;
+	}
+
+	if(c == CCL_GROW)
+	{
+		mt19937 random(GROW_SEEDS); // the same seeds for every thread count
+		vector<int> seeds(GROW_SEEDS);
+		for(int k = 0; k < GROW_SEEDS; k++)
+		{
+			seeds[k] = (int)(random() % ((unsigned)rows * cols));
+		}
+		vector<int> labels((size_t)rows * cols);
+		ConcurrentRegionGrowing<4>::grow(image.gray.data(), cols, rows, cols, ADJACENCY_RANGE, SEED_RANGE, seeds, labels.data(), cols, threads);
+		return (long long)count_if(labels.begin(), labels.end(), [](int l) { return l != 0; });
+	}
+
+	if(c == MST_GRAY || c == MST_RGB || c == MST_HIERARCHY)
+	{
+		return mstCase(c, image, threads);
+	}
+
+	return minCutCase(c, image, threads);
+}
+
+long long mstCase(int c, const benchImage& image, int threads) // edge weights and segmentation, as mst does
+{
+	int rows = image.rows, cols = image.cols, channels = c == MST_RGB ? 3 : 1;
+	MstSegmentation segmentation(rows, cols);
+
+	vector<thread> workers;
+	for(int b = 0; b < threads; b++)
+	{
+		int begin = (int)((long long)rows * b / threads), end = (int)((long long)rows * (b + 1) / threads);
+		workers.push_back(thread([&, begin, end]()
+		{
+			const unsigned char* pixels = channels == 3 ? image.bgr.data() : image.gray.data();
+			for(int y = begin; y < end; y++)
+			{
+				segmentation.weightRow(y, pixels + (size_t)y * cols * channels, pixels + (size_t)max(y - 1, 0) * cols * channels, channels);
+			}
+		}));
+	}
+	for(int b = 0; b < threads; b++)
+	{
+		workers[b].join();
+	}
+
+	if(c == MST_HIERARCHY)
+	{
+		SegmentationHierarchy hierarchy(rows * cols);
+		segmentation.buildHierarchy(&hierarchy, threads);
+	}
+	else
+	{
+		ConcurrentUnionFind disjointSet(rows * cols);
+		segmentation.segment(&disjointSet, threads);
+		vector<int> labels((size_t)rows * cols);
+		MstSegmentation::labelSegments(disjointSet, rows, cols, labels.data(), threads);
+	}
+
+	return (long long)rows * (cols - 1) + (long long)(rows - 1) * cols + 2LL * (rows - 1) * (cols - 1); // edges of the 8-connected grid
+}
+
+long long minCutCase(int c, const benchImage& image, int threads)
+{
+	graphType graph(image.rows, image.cols);
+	int s, t;
+	seedGraph(image, &graph, &s, &t);
+
+	if(c == MINCUT_PATHS || c == MINCUT_SCALING)
+	{
+		AugmentingPaths<capType> paths(&graph, s, t);
+		if(c == MINCUT_PATHS)
+		{
+			paths.maxflow();
+		}
+		else
+		{
+			paths.scalingMaxflow(intensityWeight::maxWeight);
+		}
+		return paths.augmentations;
+	}
+
+	if(c == MINCUT_BK)
+	{
+		BKMaxflow<capType> bk(&graph);
+		bk.maxflow();
+		return bk.augmentations;
+	}
+
+	ParallelPushRelabel<capType> pushRelabel(&graph, threads);
+	pushRelabel.maxflow();
+	return pushRelabel.pushes;
+}
+
+void seedGraph(const benchImage& image, graphType* graph, int* s, int* t) // capacities, one foreground and one background seed, as clicked in minCut
+{
+	graph->build(WeightTable<capType>(intensityWeight(), false), image.gray.data(), image.cols, 1);
+
+	*s = graph->index(image.cols / 3, image.rows / 2);
+	*t = graph->index(2 * image.cols / 3, image.rows / 2);
+	graph->terminal[*s] = graphType::traits::infinity();
+	graph->terminal[*t] = -graphType::traits::infinity();
+}
+
+// checks run by ctest instead of the benchmark: exit status 0 if the check passes
+
+int runCheck(const string& check, unsigned seed)
+{
+	bool passed;
+	if(check == "dynamic")
+	{
+		passed = checkDynamicCuts(seed, 500);
+	}
+	else if(check == "allocations")
+	{
+		passed = checkAllocations(seed);
+	}
+	else
+	{
+		cout << "Unknown check " << check << endl;
+		return 2;
+	}
+	cout << "check " << check << (passed ? " passed" : " failed") << endl;
+	return passed ? 0 : 1;
+}
+
+// dynamic cuts: after random capacity and terminal link changes on small grids, each re-solved from the previous flow and trees,
+// BKMaxflow::segment() has to give the source side of the minimum cut of the same graph solved from scratch
+bool checkDynamicCuts(unsigned seed, int runs)
+{
+	mt19937 random(seed);
+	int failures = 0;
+
+	for(int run = 0; run < runs; run++)
+	{
+		int rows = 1 + (int)(random() % 6), cols = 1 + (int)(random() % 6);
+		int size = rows * cols;
+		graphType graph(rows, cols);
+		vector<valueType> links(size); // terminal links as set, before any flow
+		for(int p = 0; p < size; p++)
+		{
+			for(int d = GridLayout::ARC_E; d <= GridLayout::ARC_S; d++) // every edge once, from its west or north end
+			{
+				if(graph.contains(p % cols + GridLayout::dx(d), p / cols + GridLayout::dy(d)))
+				{
+					graph.capacity[d][p] = graph.capacity[GridLayout::reverse(d)][graph.neighbour(p, d)] = (capType)(1 + random() % 8);
+				}
+			}
+			links[p] = graph.terminal[p] = (valueType)((int)(random() % 17) - 8);
+		}
+
+		BKMaxflow<capType> bk(&graph);
+		bk.maxflow();
+
+		for(int change = 0; change < 8; change++)
+		{
+			int p = (int)(random() % size), d = (int)(random() % GridLayout::NUM_ARCS);
+			if(random() % 2 && graph.hasArc(p, d))
+			{
+				bk.setCapacity(p, d, (valueType)(1 + random() % 8));
+			}
+			else
+			{
+				links[p] = (valueType)((int)(random() % 17) - 8);
+				bk.setTerminal(p, links[p]);
+			}
+			bk.maxflow();
+
+			graphType fresh(rows, cols);
+			for(int k = 0; k < GridLayout::NUM_ARCS; k++)
+			{
+				fresh.capacity[k] = graph.capacity[k];
+			}
+			fresh.terminal = links;
+			BKMaxflow<capType> solved(&fresh);
+			solved.maxflow();
+
+			vector<bool> expected;
+			sourceSide(fresh, &expected);
+			for(int q = 0; q < size; q++)
+			{
+				if((bk.segment(q) == BKMaxflow<capType>::SOURCE) != expected[q])
+				{
+					failures++;
+					break;
+				}
+			}
+		}
+	}
+
+	if(failures > 0)
+	{
+		cout << failures << " of " << runs * 8 << " dynamic cuts differ from a solve from scratch" << endl;
+	}
+	return failures == 0;
+}
+
+// allocations: the augmenting path and Boykov-Kolmogorov solvers allocate their workspaces when they are constructed, so maxflow()
+// allocates nothing, also when it re-solves from the previous flow and trees after a seed change
+bool checkAllocations(unsigned seed)
+{
+	benchImage image;
+	makeImage(0.05, 16, 8, seed, &image);
+	bool passed = true;
+
+	for(int c = MINCUT_PATHS; c <= MINCUT_BK; c++)
+	{
+		graphType graph(image.rows, image.cols);
+		int s, t;
+		seedGraph(image, &graph, &s, &t);
+
+		long long allocated;
+		if(c == MINCUT_BK)
+		{
+			BKMaxflow<capType> bk(&graph);
+			allocated = heapAllocations.load();
+			bk.maxflow();
+			bk.setSeed(graph.index(image.cols / 2, image.rows / 3), 1);
+			bk.maxflow();
+			allocated = heapAllocations.load() - allocated;
+		}
+		else
+		{
+			AugmentingPaths<capType> paths(&graph, s, t);
+			allocated = heapAllocations.load();
+			if(c == MINCUT_PATHS)
+			{
+				paths.maxflow();
+			}
+			else
+			{
+				paths.scalingMaxflow(intensityWeight::maxWeight);
+			}
+			allocated = heapAllocations.load() - allocated;
+		}
+
+		if(allocated != 0)
+		{
+			cout << "minCut " << cases[c].mode << ": " << allocated << " allocations in maxflow()" << endl;
+			passed = false;
+		}
+	}
+	return passed;
+}
+
+void sourceSide(const graphType& graph, vector<bool>* side) // pixels reachable from the source in the residual network
+{
+	side->assign(graph.size(), false);
+	vector<int> queue;
+	for(int p = 0; p < graph.size(); p++)
+	{
+		if(graphType::traits::positive(graph.terminal[p]))
+		{
+			(*side)[p] = true;
+			queue.push_back(p);
+		}
+	}
+	for(size_t k = 0; k < queue.size(); k++)
+	{
+		for(int d = 0; d < GridLayout::NUM_ARCS; d++)
+		{
+			int q = graph.neighbour(queue[k], d);
+			if(graph.hasArc(queue[k], d) && graph.unsaturated(queue[k], d) && !(*side)[q])
+			{
+				(*side)[q] = true;
+				queue.push_back(q);
+			}
+		}
+	}
+}
+
+vector<double> parseList(const string& list) // "1,2,4"
+{
+	vector<double> values;
+	istringstream in(list);
+	string item;
+	while(getline(in, item, ','))
+	{
+		if(!item.empty())
+		{
+			values.push_back(atof(item.c_str()));
+		}
+	}
+	return values;
+}
+
+void writeCsv(ostream& out, const vector<benchResult>& results) // header only for an empty list
+{
+	if(results.empty())
+	{
+		out << "tool,mode,megapixels,threads,seconds,peak_rss_kb,work,unit,work_per_second,speedup,heap_allocations" << endl;
+		return;
+	}
+
+	for(size_t k = 0; k < results.size(); k++)
+	{
+		const benchResult& r = results[k];
+		out << cases[r.c].tool << "," << cases[r.c].mode << "," << r.megapixels << "," << r.threads << "," << r.seconds << "," << r.peakKb << ","
+			<< r.work << "," << cases[r.c].unit << "," << (r.seconds > 0 ? r.work / r.seconds : 0) << "," << r.speedup << "," << r.allocations << endl;
+	}
+}
+
+void writeJson(ostream& out, const vector<benchResult>& results)
+{
+	out << "[" << endl;
+	for(size_t k = 0; k < results.size(); k++)
+	{
+		const benchResult& r = results[k];
+		out << "  {\"tool\": \"" << cases[r.c].tool << "\", \"mode\": \"" << cases[r.c].mode << "\", \"megapixels\": " << r.megapixels
+			<< ", \"threads\": " << r.threads << ", \"seconds\": " << r.seconds << ", \"peak_rss_kb\": " << r.peakKb << ", \"work\": " << r.work
+			<< ", \"unit\": \"" << cases[r.c].unit << "\", \"work_per_second\": " << (r.seconds > 0 ? r.work / r.seconds : 0)
+			<< ", \"speedup\": " << r.speedup << ", \"heap_allocations\": " << r.allocations << "}" << (k + 1 < results.size() ? "," : "") << endl;
+	}
+	out << "]" << endl;
+}
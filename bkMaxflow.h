@@ -0,0 +1,561 @@
+#ifndef BK_MAXFLOW_H
+#define BK_MAXFLOW_H
+
+#include <vector>
+#include <algorithm>
+#include <limits.h>
+
+#include "gridGraph.h"
+#include "instrumentation.h"
+
+// Boykov-Kolmogorov max-flow on a GridGraph ("An Experimental Comparison of Min-Cut/Max-Flow Algorithms for Energy Minimization in Vision", PAMI 2004).
+// Two search trees are grown from the terminals (source tree over non-saturated arcs leaving it, sink tree over non-saturated arcs entering it);
+// when they touch, flow is pushed along the path and the nodes cut off by saturated arcs are re-attached (adopted) instead of regrowing the trees from scratch.
+// Terminal links are read from graph.terminal; flow is written to graph.flow / graph.terminal, so markCut works on the result unchanged.
+// maxflow() can be called again after setSeed() or setCapacity(): the flow and both trees are kept and only the nodes affected by the change
+// are repaired ("dynamic graph cuts", Kohli and Torr, ICCV 2005).
+// All arrays, the active and orphan queues included, are allocated with the solver: maxflow() allocates nothing.
+
+class NodeQueue // FIFO of node indices in a ring buffer of fixed capacity; the solver never queues a node twice
+{
+public:
+	NodeQueue(int capacity) : nodes(std::max(capacity, 1)), head(0), count(0) {}
+
+	bool empty() const
+	{
+		return count == 0;
+	}
+
+	void push(int p)
+	{
+		int tail = head + count;
+		nodes[tail < (int)nodes.size() ? tail : tail - (int)nodes.size()] = p;
+		count++;
+	}
+
+	int pop()
+	{
+		int p = nodes[head];
+		head = head + 1 < (int)nodes.size() ? head + 1 : 0;
+		count--;
+		return p;
+	}
+
+private:
+	std::vector<int> nodes;
+	int head, count;
+};
+
+template <typename capType, typename graphType = GridGraph<capType> > // graphType: GridGraph or any graph with the same interface (BandGraph)
+class BKMaxflow
+{
+public:
+	typedef typename graphType::traits traits;
+	typedef typename graphType::valueType valueType;
+
+	enum treeType
+	{
+		FREE = 0, SOURCE, SINK
+	};
+
+	int augmentations; // number of augmenting paths
+
+	BKMaxflow(graphType* graph) : augmentations(0), graph(graph), active(graph->size()), orphans(graph->size()), time(0), initialized(false)
+	{
+		tree.assign(graph->size(), FREE);
+		parent.assign(graph->size(), NO_PARENT);
+		ts.assign(graph->size(), 0);
+		dist.assign(graph->size(), 0);
+		inActive.assign(graph->size(), false);
+		inOrphans.assign(graph->size(), false);
+	}
+
+	valueType maxflow()
+	{
+		valueType totalFlow = 0;
+
+		if(!initialized) // terminal links start both trees
+		{
+			for(int p = 0; p < graph->size(); p++)
+			{
+				if(linkedToSource(p) || linkedToSink(p))
+				{
+					setTerminalParent(p);
+				}
+			}
+			initialized = true;
+		}
+
+		adoptOrphans(); // nodes cut off by terminal changes since the last call
+
+		int current = -1; // node being grown; kept across augmentations as the original algorithm does
+
+		while(true)
+		{
+			// grow
+
+			if(current != -1 && tree[current] == FREE)
+			{
+				current = -1;
+			}
+			if(current == -1)
+			{
+				current = nextActive();
+				if(current == -1)
+				{
+					break;
+				}
+			}
+
+			int pathNode = -1, pathDir = -1; // arc (pathNode, pathDir) goes from the source tree to the sink tree
+
+			for(int d = 0; d < GridLayout::NUM_ARCS && pathNode == -1; d++)
+			{
+				if(!graph->hasArc(current, d))
+				{
+					continue;
+				}
+				if(tree[current] == SOURCE ? !graph->unsaturated(current, d) : !traits::positive(residualTo(current, d)))
+				{
+					continue;
+				}
+
+				int q = graph->neighbour(current, d);
+
+				if(tree[q] == FREE) // q joins the tree of "current"
+				{
+					tree[q] = tree[current];
+					parent[q] = GridLayout::reverse(d);
+					ts[q] = ts[current];
+					dist[q] = dist[current] + 1;
+					setActive(q);
+				}
+				else if(tree[q] != tree[current]) // trees touch
+				{
+					pathNode = tree[current] == SOURCE ? current : q;
+					pathDir = tree[current] == SOURCE ? d : GridLayout::reverse(d);
+				}
+				else if(ts[q] <= ts[current] && dist[q] > dist[current]) // heuristic: shorten paths to the terminal
+				{
+					parent[q] = GridLayout::reverse(d);
+					ts[q] = ts[current];
+					dist[q] = dist[current] + 1;
+				}
+			}
+
+			time++;
+
+			if(pathNode == -1)
+			{
+				current = -1; // no path from this node; it is no longer active
+				continue;
+			}
+
+			// augment
+
+			totalFlow += augment(pathNode, pathDir);
+			augmentations++;
+			INSTRUMENT_COUNT(COUNTER_AUGMENTING_PATHS, 1);
+
+			// adopt
+
+			adoptOrphans();
+		}
+
+		return totalFlow;
+	}
+
+	void setSeed(int p, int label) // label > 0: foreground seed, < 0: background seed, 0: no longer a seed; call maxflow() afterwards
+	{
+		time++; // distances checked during the last adoption may go through p
+
+		if(label != 0)
+		{
+			graph->terminal[p] = label > 0 ? traits::infinity() : -traits::infinity(); // infinite capacity; the flow already through p stays valid
+		}
+		else
+		{
+			// the flow p used to emit (or absorb) as a terminal has to be balanced: linking p to both terminals with that amount
+			// keeps the current flow feasible and adds the same constant to every cut
+			graph->terminal[p] = -graph->netOutflow(p);
+		}
+
+		terminalChanged(p);
+	}
+
+	void setTerminal(int p, valueType capacity) // new net terminal link of p (> 0 from the source, < 0 to the sink); call maxflow() afterwards
+	{
+		time++;
+
+		// residual = capacity minus the flow that already goes through the link, which stays valid; as in setSeed(), the link may
+		// end up pointing to the other terminal
+		graph->terminal[p] = capacity - graph->netOutflow(p);
+
+		terminalChanged(p);
+	}
+
+	void setCapacity(int p, int d, valueType capacity) // new capacity of the edge between p and its neighbour in direction d, both ways; call maxflow() afterwards
+	{
+		time++;
+
+		int q = graph->neighbour(p, d), r = GridLayout::reverse(d);
+
+		// flow above the new capacity is taken back; the excess it leaves at the tail and the deficit at the head are balanced by
+		// their terminal links, which adds the same constant to every cut, as in setSeed()
+		for(int k = 0; k < 2; k++)
+		{
+			int from = k == 0 ? p : q, dir = k == 0 ? d : r;
+			valueType excess = (valueType)graph->flow[dir][from] - capacity;
+			if(traits::positive(excess))
+			{
+				graph->push(from, dir, -excess);
+				graph->terminal[from] += excess;
+				graph->terminal[graph->neighbour(from, dir)] -= excess;
+			}
+		}
+		graph->capacity[d][p] = capacity;
+		graph->capacity[r][q] = capacity;
+
+		terminalChanged(p);
+		terminalChanged(q);
+
+		if(parent[p] == d && !validParentArc(p, d)) // a tree arc lost its residual capacity
+		{
+			setOrphan(p);
+		}
+		if(parent[q] == r && !validParentArc(q, r))
+		{
+			setOrphan(q);
+		}
+
+		if(tree[p] != FREE) // an arc that gained residual capacity may let a tree grow or the trees touch
+		{
+			setActive(p);
+		}
+		if(tree[q] != FREE)
+		{
+			setActive(q);
+		}
+	}
+
+	treeType segment(int p) const // after maxflow(): SOURCE for nodes reachable from the source in the residual network
+	{
+		return tree[p] == SOURCE ? SOURCE : SINK;
+	}
+
+private:
+	enum parentType // besides directions 0..NUM_ARCS-1
+	{
+		TERMINAL = GridLayout::NUM_ARCS, ORPHAN, NO_PARENT
+	};
+
+	graphType* graph;
+
+	std::vector<unsigned char> tree;
+	std::vector<unsigned char> parent; // direction of the arc to the parent, or TERMINAL / ORPHAN / NO_PARENT
+	std::vector<int> ts; // time stamp of the last time dist was known to be correct
+	std::vector<int> dist; // distance to the terminal
+	std::vector<bool> inActive, inOrphans;
+	NodeQueue active, orphans; // a node is in each at most once (inActive, inOrphans)
+	int time;
+	bool initialized;
+
+	void terminalChanged(int p) // repairs the trees after the terminal link of p changed
+	{
+		if(!initialized)
+		{
+			return;
+		}
+
+		if(linkedToSource(p) ? tree[p] != SOURCE : linkedToSink(p) ? tree[p] != SINK : false) // p changes tree
+		{
+			for(int d = 0; d < GridLayout::NUM_ARCS; d++)
+			{
+				if(!graph->hasArc(p, d))
+				{
+					continue;
+				}
+				int q = graph->neighbour(p, d);
+				if(tree[q] == tree[p] && parent[q] == GridLayout::reverse(d))
+				{
+					setOrphan(q);
+				}
+				// the nodes of p's old tree were not active for their arcs to p: if p is freed later, they have to grow into it again
+				if(tree[q] != FREE)
+				{
+					setActive(q);
+				}
+			}
+		}
+
+		if(linkedToSource(p) || linkedToSink(p))
+		{
+			setTerminalParent(p);
+		}
+		else if(parent[p] == TERMINAL)
+		{
+			setOrphan(p);
+		}
+	}
+
+	bool linkedToSource(int p) const // residual capacity on the terminal link of p
+	{
+		return traits::positive(graph->terminal[p]);
+	}
+
+	bool linkedToSink(int p) const
+	{
+		return traits::positive(-graph->terminal[p]);
+	}
+
+	valueType residualTo(int p, int d) const // residual capacity of the arc from the neighbour of p in direction d to p
+	{
+		return graph->residual(graph->neighbour(p, d), GridLayout::reverse(d));
+	}
+
+	void setActive(int p)
+	{
+		if(!inActive[p])
+		{
+			inActive[p] = true;
+			active.push(p);
+		}
+	}
+
+	int nextActive()
+	{
+		while(!active.empty())
+		{
+			int p = active.pop();
+			inActive[p] = false;
+
+			if(tree[p] != FREE)
+			{
+				INSTRUMENT_COUNT(COUNTER_BFS_NODES, 1);
+				return p;
+			}
+		}
+		return -1;
+	}
+
+	void setTerminalParent(int p) // p becomes a root of the tree of its terminal link
+	{
+		tree[p] = linkedToSource(p) ? SOURCE : SINK;
+		parent[p] = TERMINAL;
+		ts[p] = time;
+		dist[p] = 1;
+		setActive(p);
+	}
+
+	void adoptOrphans()
+	{
+		while(!orphans.empty())
+		{
+			int orphan = orphans.pop();
+			inOrphans[orphan] = false;
+			if(parent[orphan] == ORPHAN)
+			{
+				adopt(orphan);
+			}
+		}
+	}
+
+	void setOrphan(int p)
+	{
+		parent[p] = ORPHAN;
+		if(!inOrphans[p])
+		{
+			inOrphans[p] = true;
+			orphans.push(p);
+		}
+	}
+
+	valueType augment(int p, int d)
+	{
+		valueType flow = graph->residual(p, d);
+		INSTRUMENT_COUNT(COUNTER_PATH_LENGTH, 1); // the arc between the trees
+
+		// bottleneck in the source tree
+		for(int x = p; ; x = graph->neighbour(x, parent[x]))
+		{
+			if(parent[x] == TERMINAL)
+			{
+				flow = std::min(flow, graph->terminal[x]);
+				break;
+			}
+			flow = std::min(flow, residualTo(x, parent[x]));
+			INSTRUMENT_COUNT(COUNTER_PATH_LENGTH, 1);
+		}
+
+		// bottleneck in the sink tree
+		for(int x = graph->neighbour(p, d); ; x = graph->neighbour(x, parent[x]))
+		{
+			if(parent[x] == TERMINAL)
+			{
+				flow = std::min(flow, -graph->terminal[x]);
+				break;
+			}
+			flow = std::min(flow, graph->residual(x, parent[x]));
+			INSTRUMENT_COUNT(COUNTER_PATH_LENGTH, 1);
+		}
+
+		graph->push(p, d, flow);
+
+		for(int x = p; ; )
+		{
+			int next = parent[x] == TERMINAL ? -1 : graph->neighbour(x, parent[x]);
+			if(next == -1)
+			{
+				graph->terminal[x] -= flow;
+				if(!linkedToSource(x))
+				{
+					setOrphan(x);
+				}
+				break;
+			}
+			graph->push(next, GridLayout::reverse(parent[x]), flow);
+			if(!traits::positive(residualTo(x, parent[x])))
+			{
+				setOrphan(x);
+			}
+			x = next;
+		}
+
+		for(int x = graph->neighbour(p, d); ; )
+		{
+			int next = parent[x] == TERMINAL ? -1 : graph->neighbour(x, parent[x]);
+			if(next == -1)
+			{
+				graph->terminal[x] += flow;
+				if(!linkedToSink(x))
+				{
+					setOrphan(x);
+				}
+				break;
+			}
+			graph->push(x, parent[x], flow);
+			if(!graph->unsaturated(x, parent[x]))
+			{
+				setOrphan(x);
+			}
+			x = next;
+		}
+
+		return flow;
+	}
+
+	bool validParentArc(int p, int d) const // the arc between p and its neighbour in direction d can carry p's tree
+	{
+		return tree[p] == SOURCE ? traits::positive(residualTo(p, d)) : graph->unsaturated(p, d);
+	}
+
+	void adopt(int p)
+	{
+		if(tree[p] == SOURCE ? linkedToSource(p) : linkedToSink(p)) // still linked to its terminal
+		{
+			parent[p] = TERMINAL;
+			ts[p] = time;
+			dist[p] = 1;
+			return;
+		}
+
+		int bestDir = NO_PARENT;
+		int bestDist = INT_MAX;
+
+		for(int d = 0; d < GridLayout::NUM_ARCS; d++)
+		{
+			if(!graph->hasArc(p, d))
+			{
+				continue;
+			}
+			int q = graph->neighbour(p, d);
+			if(tree[q] != tree[p] || !validParentArc(p, d))
+			{
+				continue;
+			}
+
+			// check that q is connected to the terminal, measuring the distance on the way
+			int length = 0;
+			int x = q;
+			while(true)
+			{
+				if(ts[x] == time)
+				{
+					length += dist[x];
+					break;
+				}
+				length++;
+				if(parent[x] == TERMINAL)
+				{
+					ts[x] = time;
+					dist[x] = 1;
+					break;
+				}
+				if(parent[x] >= ORPHAN)
+				{
+					length = INT_MAX;
+					break;
+				}
+				x = graph->neighbour(x, parent[x]);
+			}
+
+			if(length == INT_MAX)
+			{
+				continue;
+			}
+
+			if(length < bestDist)
+			{
+				bestDir = d;
+				bestDist = length;
+			}
+
+			for(x = q; ts[x] != time; x = graph->neighbour(x, parent[x])) // remember distances along the checked path
+			{
+				ts[x] = time;
+				dist[x] = length--;
+			}
+		}
+
+		if(bestDir != NO_PARENT)
+		{
+			parent[p] = bestDir;
+			ts[p] = time;
+			dist[p] = bestDist + 1;
+			return;
+		}
+
+		// no valid parent: p becomes free, its children become orphans and its tree neighbours may grow into it again
+
+		for(int d = 0; d < GridLayout::NUM_ARCS; d++)
+		{
+			if(!graph->hasArc(p, d))
+			{
+				continue;
+			}
+			int q = graph->neighbour(p, d);
+			if(tree[q] != tree[p])
+			{
+				continue;
+			}
+			if(validParentArc(p, d))
+			{
+				setActive(q);
+			}
+			if(parent[q] == GridLayout::reverse(d))
+			{
+				setOrphan(q);
+			}
+		}
+
+		tree[p] = FREE;
+		parent[p] = NO_PARENT;
+
+		if(linkedToSource(p) || linkedToSink(p)) // only possible after setSeed() or setTerminal(): p is linked to the other terminal
+		{
+			setTerminalParent(p);
+		}
+	}
+};
+
+#endif
@@ -0,0 +1,226 @@
+#ifndef BLOCK_LABELLING_H
+#define BLOCK_LABELLING_H
+
+#include <vector>
+#include <thread>
+#include <algorithm>
+#include <stddef.h>
+
+#include "concurrentUnionFind.h"
+#include "gridTopology.h"
+
+// Connected component labelling of a binary mask, 8-connectivity, in two passes over 2x2 blocks ("Optimized Block-based Connected
+// Components Labeling with Decision Trees", Grana, Borghesani and Cucchiara, 2010). The foreground pixels of a block are always
+// connected, so the first pass unites blocks instead of pixels: with the block X, its left neighbour S and the blocks P, Q, R above
+//
+//	P Q R      a b   pixels of a block
+//	S X        c d
+//
+// X joins a neighbour if a foreground pixel of X touches one of the neighbour, and a join is skipped when an earlier test already
+// implies it (e.g. P and Q were united when Q was scanned if Q.c is set). Rows of blocks are split into strips that are scanned
+// by separate threads; the strips are then stitched with the same tests along their borders, and the second pass numbers the
+// components 1 .. count in raster order of their first block and writes the label of every pixel (0 for the background).
+
+class BlockLabelling
+{
+public:
+	// mask: nonzero for foreground, maskStep bytes per row; labels: int32, labelStep ints per row. Returns the number of components.
+	static int label(const unsigned char* mask, size_t maskStep, int rows, int cols, int* labels, size_t labelStep, int threads)
+	{
+		BlockLabelling scan(mask, maskStep, rows, cols);
+
+		threads = std::max(1, std::min(threads, scan.blockRows));
+		std::vector<int> stripStart(threads + 1); // first block row of every strip
+		for(int t = 0; t <= threads; t++)
+		{
+			stripStart[t] = (int)((long long)scan.blockRows * t / threads);
+		}
+
+		std::vector<std::thread> workers;
+		for(int t = 0; t < threads; t++)
+		{
+			workers.push_back(std::thread(&BlockLabelling::scanStrip, &scan, stripStart[t], stripStart[t + 1]));
+		}
+		joinAll(&workers);
+
+		for(int t = 1; t < threads; t++) // every border between two strips
+		{
+			workers.push_back(std::thread(&BlockLabelling::joinBlockRow, &scan, stripStart[t]));
+		}
+		joinAll(&workers);
+
+		std::vector<int> roots(threads, 0);
+		for(int t = 0; t < threads; t++)
+		{
+			workers.push_back(std::thread(&BlockLabelling::countRoots, &scan, stripStart[t], stripStart[t + 1], &roots[t]));
+		}
+		joinAll(&workers);
+
+		int count = 0; // labels of a strip start after the components that begin in the strips above it
+		for(int t = 0; t < threads; t++)
+		{
+			workers.push_back(std::thread(&BlockLabelling::numberRoots, &scan, stripStart[t], stripStart[t + 1], count + 1));
+			count += roots[t];
+		}
+		joinAll(&workers);
+
+		for(int t = 0; t < threads; t++)
+		{
+			workers.push_back(std::thread(&BlockLabelling::writeLabels, &scan, stripStart[t], stripStart[t + 1], labels, labelStep));
+		}
+		joinAll(&workers);
+
+		return count;
+	}
+
+private:
+	const unsigned char* mask;
+	size_t step;
+	GridTopology<8> grid;
+	int rows, cols, blockRows, blockCols;
+	ConcurrentUnionFind blocks;
+	std::vector<unsigned char> occupied; // block has a foreground pixel
+	std::vector<int> blockLabel; // final label of every root block
+
+	BlockLabelling(const unsigned char* mask, size_t step, int rows, int cols) : mask(mask), step(step), grid(rows, cols), rows(rows), cols(cols),
+		blockRows((rows + 1) / 2), blockCols((cols + 1) / 2), blocks(blockRows * blockCols), occupied(blockRows * blockCols, 0),
+		blockLabel(blockRows * blockCols, 0)
+	{
+	}
+
+	static void joinAll(std::vector<std::thread>* workers)
+	{
+		for(size_t t = 0; t < workers->size(); t++)
+		{
+			(*workers)[t].join();
+		}
+		workers->clear();
+	}
+
+	bool at(int r, int c) const // foreground test that is false outside the image
+	{
+		return grid.contains(c, r) && mask[r * step + c];
+	}
+
+	void scanStrip(int begin, int end) // first pass over the block rows [begin, end): blocks above the strip are not looked at
+	{
+		for(int br = begin; br < end; br++)
+		{
+			int r = 2 * br;
+			for(int bc = 0; bc < blockCols; bc++)
+			{
+				int c = 2 * bc, x = br * blockCols + bc;
+				bool a = at(r, c), b = at(r, c + 1), cc = at(r + 1, c), d = at(r + 1, c + 1);
+				if(!(a || b || cc || d))
+				{
+					continue;
+				}
+				occupied[x] = 1;
+
+				bool sb = at(r, c - 1), sd = at(r + 1, c - 1);
+				bool s = (sb || sd) && (a || cc);
+				bool q = false;
+				if(br > begin)
+				{
+					bool qc = at(r - 1, c), qd = at(r - 1, c + 1);
+					q = (qc || qd) && (a || b);
+					if(q)
+					{
+						blocks.unite(x, x - blockCols);
+					}
+					if(a && at(r - 1, c - 1) && !(q && qc) && !(s && sb)) // P: already joined through Q.c or S.b
+					{
+						blocks.unite(x, x - blockCols - 1);
+					}
+					if(b && at(r - 1, c + 2) && !(q && qd)) // R: already joined through Q.d
+					{
+						blocks.unite(x, x - blockCols + 1);
+					}
+					if(s && q && qc && sb) // S.b touches Q.c: S and Q were joined when S was scanned
+					{
+						continue;
+					}
+				}
+				if(s)
+				{
+					blocks.unite(x, x - 1);
+				}
+			}
+		}
+	}
+
+	void joinBlockRow(int br) // joins the blocks of row br with those above it, across a strip border
+	{
+		int r = 2 * br;
+		for(int bc = 0; bc < blockCols; bc++)
+		{
+			int c = 2 * bc, x = br * blockCols + bc;
+			bool a = at(r, c), b = at(r, c + 1);
+			if(!(a || b))
+			{
+				continue;
+			}
+			if(at(r - 1, c) || at(r - 1, c + 1))
+			{
+				blocks.unite(x, x - blockCols);
+			}
+			if(a && at(r - 1, c - 1))
+			{
+				blocks.unite(x, x - blockCols - 1);
+			}
+			if(b && at(r - 1, c + 2))
+			{
+				blocks.unite(x, x - blockCols + 1);
+			}
+		}
+	}
+
+	bool isRoot(int x)
+	{
+		return occupied[x] && blocks.find(x) == x;
+	}
+
+	void countRoots(int begin, int end, int* roots)
+	{
+		for(int x = begin * blockCols; x < end * blockCols; x++)
+		{
+			if(isRoot(x))
+			{
+				(*roots)++;
+			}
+		}
+	}
+
+	void numberRoots(int begin, int end, int firstLabel)
+	{
+		int next = firstLabel;
+		for(int x = begin * blockCols; x < end * blockCols; x++)
+		{
+			if(isRoot(x))
+			{
+				blockLabel[x] = next++;
+			}
+		}
+	}
+
+	void writeLabels(int begin, int end, int* labels, size_t labelStep) // second pass
+	{
+		for(int r = 2 * begin; r < std::min(2 * end, rows); r++)
+		{
+			const unsigned char* in = mask + r * step;
+			int* out = labels + r * labelStep;
+			int x = (r / 2) * blockCols;
+			for(int c = 0; c < cols; c += 2, x++)
+			{
+				int component = occupied[x] ? blockLabel[blocks.find(x)] : 0;
+				out[c] = in[c] ? component : 0;
+				if(c + 1 < cols)
+				{
+					out[c + 1] = in[c + 1] ? component : 0;
+				}
+			}
+		}
+	}
+};
+
+#endif
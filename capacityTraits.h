@@ -0,0 +1,74 @@
+#ifndef CAPACITY_TRAITS_H
+#define CAPACITY_TRAITS_H
+
+#include <stdint.h>
+#include <limits.h>
+#include <float.h>
+#include <type_traits>
+
+// Per capacity type: the type an arc's flow is stored in, the type residuals/excesses/terminal links are computed in,
+// the "infinite" terminal capacity of a seed and the test for a non-saturated arc.
+// Integer capacities are exact; only the float path needs a tolerance for rounding.
+
+template <typename capType> struct capacityTraits;
+
+template <> struct capacityTraits<uint16_t> // capacities up to 32767 so that flows fit in int16_t: 4 bytes per arc
+{
+	typedef int16_t flowType;
+	typedef int32_t valueType;
+	static const int32_t maxCapacity = 32767;
+
+	static valueType infinity()
+	{
+		return INT32_MAX / 2; // no overflow when flow of the seed's arcs is added or subtracted
+	}
+
+	static bool positive(valueType x)
+	{
+		return x > 0;
+	}
+};
+
+template <> struct capacityTraits<int32_t>
+{
+	typedef int32_t flowType;
+	typedef int64_t valueType;
+	static const int32_t maxCapacity = INT32_MAX / 2;
+
+	static valueType infinity()
+	{
+		return INT64_MAX / 4;
+	}
+
+	static bool positive(valueType x)
+	{
+		return x > 0;
+	}
+};
+
+template <> struct capacityTraits<float>
+{
+	typedef float flowType;
+	typedef float valueType;
+
+	static valueType infinity()
+	{
+		return FLT_MAX;
+	}
+
+	static bool positive(valueType x) // residuals below this are treated as saturated
+	{
+		return x > 0.00001f;
+	}
+};
+
+// capacity type for a weight model: the smallest exact integer type that holds its weights, float for non-integral weights.
+// A model declares "static const bool integral" and "static const int maxWeight".
+
+template <typename weightModel> struct capacityFor
+{
+	typedef typename std::conditional<!weightModel::integral, float,
+		typename std::conditional<weightModel::maxWeight <= capacityTraits<uint16_t>::maxCapacity, uint16_t, int32_t>::type>::type type;
+};
+
+#endif
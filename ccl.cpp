@@ -1,6 +1,9 @@
 #include <iostream>
+#include <fstream>
+#include <string>
 #include <queue>
 #include <vector>
+#include <thread>
 
 #include <opencv2/opencv.hpp>
 //#include <opencv2/nonfree/nonfree.hpp>
@@ -8,66 +11,180 @@
 #include <opencv2/features2d.hpp>
 //#include <opencv2/xfeatures2d.hpp>
 
+#include "gridTopology.h"
+#include "blockLabelling.h"
+#include "concurrentRegionGrowing.h"
+#include "instrumentation.h"
+#include "batchPipeline.h"
+#include "sidecarSeeds.h"
+#include "mappedImage.h"
+#include "segmentationServer.h"
+
 using namespace std;
 using namespace cv;
 //using namespace cv::xfeatures2d;
 
 const int ADJACENCY_RANGE = 10;
 const int SEED_RANGE = 50;
+const int CONNECTIVITY = 4; // of the grown regions: 4 or 8
+
+typedef GridTopology<CONNECTIVITY> pixelGrid;
 
-enum connectivity // directions
+struct span // run of region pixels [left, right] on row y
 {
-	N = 1, NE, E, SE, S, SW, W, NW
+	int y, left, right;
 };
 
 void initialMouseCallback(int, int, int, int, void*);
 void finalMouseCallback(int, int, int, int, void*);
-void processQueue(queue<Point>, int, int, Mat*, Mat, int, int);
-Point neighbour(Point, int, int, int);
-void checkAndAssign(Point, int, int, int, Vec3b, Mat*, queue<Point>*);
+void growRegion(Point, int, int, Mat*, Mat*, const Mat&);
+span fillSpan(const Mat&, Mat*, int, int, int);
+bool accepted(int, int, int);
+void colourComponents(const Mat&, int, Mat*);
+int runBatch(int, char**);
+int runServer(int, char**);
+void labelImage(const Mat&, int, Mat*);
+bool readGray(const string&, MappedImage*, Mat*);
+bool readRequest(const serverRequest&, MappedImage*, Mat*);
 
 int main(int argc, char** argv)
 {
-	Mat input = imread(argv[1], IMREAD_COLOR);
+	if(argc >= 2 && string(argv[1]) == "batch") // headless: "batch <directory or list file> <threshold>|parallel [threads]"
+	{
+		return runBatch(argc, argv);
+	}
+	if(argc >= 2 && string(argv[1]) == "serve") // resident: "serve <socket path> [threads]", see segmentationServer.h
+	{
+		return runServer(argc, argv);
+	}
+
+	INSTRUMENT_REPORT(string(argv[1]) + ".stats.json"); // with -DINSTRUMENTATION: phase times and solver counters of this run
+
+	INSTRUMENT_BEGIN(PHASE_DECODE);
+	MappedImage mapped; // 8 bit PGM/PPM/raw input is read in place
 	Mat gray_input;
 
-	cvtColor(input, gray_input, COLOR_BGR2GRAY); // convert to grayscale (weighted formula)
+	if(!readGray(argv[1], &mapped, &gray_input))
+	{
+		cout << "Could not read " << argv[1] << endl;
+		return 0;
+	}
+	INSTRUMENT_END(PHASE_DECODE);
+
+	bool parallel = argc >= 3 && string(argv[2]) == "parallel"; // all seeds grow at once: "parallel [threads] [seed file]"
+	int threads = argc >= 4 ? atoi(argv[3]) : (int)thread::hardware_concurrency(); // optional third argument: number of threads
+
+	if(argc >= 3 && !parallel) // labelling: every 8-connected component of the pixels brighter than the threshold given as second argument
+	{
+		int level = atoi(argv[2]);
+
+		INSTRUMENT_BEGIN(PHASE_SOLVE);
+		Mat mask;
+		threshold(gray_input, mask, level, 255, THRESH_BINARY);
+
+		Mat labels(gray_input.rows, gray_input.cols, CV_32SC1); // 0 for the background, components 1 .. componentCount
+		int componentCount = BlockLabelling::label(mask.ptr<uchar>(0), mask.step, mask.rows, mask.cols, labels.ptr<int>(0), labels.step / sizeof(int), max(threads, 1));
+		INSTRUMENT_END(PHASE_SOLVE);
+		cout << componentCount << " components" << endl;
+
+		INSTRUMENT_BEGIN(PHASE_RENDER);
+		Mat output(gray_input.rows, gray_input.cols, CV_8UC3, Scalar(0, 0, 0));
+		colourComponents(labels, componentCount, &output);
+
+		namedWindow("final", WINDOW_NORMAL);
+		imshow("final", output);
+		INSTRUMENT_END(PHASE_RENDER);
+
+		waitKey(0);
+
+		return 0;
+	}
 
 	Mat output(gray_input.rows, gray_input.cols, gray_input.type()%7 + 16, Vec3b(0, 0, 0)); // initialize same sized image - all black
 
 	// black in output image means the pixel is not connected to any component
 
-	namedWindow("gray", WINDOW_NORMAL); // display grayscale image
-	imshow("gray", gray_input);
-
-	waitKey(100);
+	Mat visited(gray_input.rows, gray_input.cols, CV_8UC1, Scalar(0)); // 1 once a pixel belongs to a component
 
 	queue<Point> seedsQueue;
 
-	cout << "Select all seed points and then press any key" << endl;
+	if(parallel && argc >= 5) // seed file: one "x y" per line, as printed for clicked seeds
+	{
+		ifstream seedFile(argv[4]);
+		int x, y;
+		while(seedFile >> x >> y)
+		{
+			seedsQueue.push(Point(x, y));
+		}
+	}
+	else
+	{
+		namedWindow("gray", WINDOW_NORMAL); // display grayscale image
+		imshow("gray", gray_input);
 
-	setMouseCallback("gray", initialMouseCallback, &seedsQueue); // record all clicked points as seed points
+		waitKey(100);
 
-	waitKey(0);
+		cout << "Select all seed points and then press any key" << endl;
+
+		setMouseCallback("gray", initialMouseCallback, &seedsQueue); // record all clicked points as seed points
+
+		waitKey(0);
+
+		setMouseCallback("gray", finalMouseCallback, NULL); // disregard mouse input now
+	}
+
+	if(parallel)
+	{
+		vector<int> seeds; // pixel indices, seed k is labelled k + 1
+		while(!seedsQueue.empty())
+		{
+			Point seed = seedsQueue.front();
+			seedsQueue.pop();
+			if(seed.x < 0 || seed.x >= gray_input.cols || seed.y < 0 || seed.y >= gray_input.rows)
+			{
+				cout << "Ignoring seed " << seed.x << " " << seed.y << " outside the image" << endl;
+				continue;
+			}
+			seeds.push_back(seed.y * gray_input.cols + seed.x);
+		}
+
+		INSTRUMENT_BEGIN(PHASE_SOLVE);
+		Mat labels(gray_input.rows, gray_input.cols, CV_32SC1); // 0 where no region grew
+		ConcurrentRegionGrowing<CONNECTIVITY>::grow(gray_input.ptr<uchar>(0), gray_input.step, gray_input.rows, gray_input.cols, ADJACENCY_RANGE, SEED_RANGE, seeds, labels.ptr<int>(0), labels.step / sizeof(int), max(threads, 1));
+		INSTRUMENT_END(PHASE_SOLVE);
+
+		INSTRUMENT_BEGIN(PHASE_RENDER);
+		Mat output(gray_input.rows, gray_input.cols, CV_8UC3, Scalar(0, 0, 0));
+		colourComponents(labels, (int)seeds.size(), &output);
 
-	setMouseCallback("gray", finalMouseCallback, NULL); // disregard mouse input now
+		namedWindow("final", WINDOW_NORMAL);
+		imshow("final", output);
+		INSTRUMENT_END(PHASE_RENDER);
+
+		waitKey(0);
+
+		return 0;
+	}
 
 	int i = 1;
 	int numSeeds = seedsQueue.size();
 
+	INSTRUMENT_BEGIN(PHASE_SOLVE); // regions are coloured as they grow
 	while(!seedsQueue.empty())
 	{
-		queue<Point> q;
-		q.push(seedsQueue.front()); // dequeue seed point
+		Point seed = seedsQueue.front(); // dequeue seed point
 		seedsQueue.pop();
 
-		processQueue(q, i, numSeeds, &output, gray_input, gray_input.cols, gray_input.rows); // start labelling pixels starting from seed point
+		growRegion(seed, i, numSeeds, &visited, &output, gray_input); // start labelling pixels starting from seed point
 
 		i++;
 	}
+	INSTRUMENT_END(PHASE_SOLVE);
 
+	INSTRUMENT_BEGIN(PHASE_RENDER);
 	namedWindow("final", WINDOW_NORMAL);
 	imshow("final", output);
+	INSTRUMENT_END(PHASE_RENDER);
 
 	waitKey(0);
 
@@ -91,10 +208,12 @@ void finalMouseCallback(int event, int x, int y, int flags, void* userdata)
 	return;
 }
 
-void processQueue(queue<Point> q, int i, int numSeeds, Mat* output, Mat input, int cols, int rows)
-{
-	Point seed = q.front();
+// region growing: a pixel joins the region of its neighbour (CONNECTIVITY) if it is within ADJACENCY_RANGE of that neighbour and within SEED_RANGE
+// of the seed. The region is grown in horizontal spans: a span is extended left and right as far as the predicate holds, and only
+// spans are kept on the stack. Scanning the rows above and below a span starts a new span at every pixel that joins it.
 
+void growRegion(Point seed, int i, int numSeeds, Mat* visited, Mat* output, const Mat& input)
+{
 	Vec3b regionIntensity;
 
 	// each connected component is assigned a different colour calculated here
@@ -102,99 +221,348 @@ void processQueue(queue<Point> q, int i, int numSeeds, Mat* output, Mat input, i
 	regionIntensity[1] = ((255/numSeeds)*(i+1))%256;
 	regionIntensity[2] = ((255/numSeeds)*(i-1))%256;
 
-	output->at<Vec3b>(seed) = regionIntensity;
-
 	int seedIntensity = input.at<uchar>(seed);
 
-	while(!q.empty())
+	vector<span> spans;
+	spans.push_back(fillSpan(input, visited, seed.x, seed.y, seedIntensity)); // the seed belongs to the region even if an earlier one took it
+
+	while(!spans.empty())
 	{
-		Point curPoint = q.front();
-		q.pop();
+		span cur = spans.back();
+		spans.pop_back();
 
-		Point adj;
-		for(int i = 1; i <= 8; i+=2) // i+=2 for 8-connectivity; i++ for 4-connectivity
+		Vec3b* out = output->ptr<Vec3b>(cur.y);
+		for(int x = cur.left; x <= cur.right; x++)
 		{
-			adj = neighbour(curPoint, i, cols, rows);
-			if(adj.x != -1 && adj.y != -1 && output->at<Vec3b>(adj)[0] == 0 && output->at<Vec3b>(adj)[1] == 0 && output->at<Vec3b>(adj)[2] == 0)
+			out[x] = regionIntensity; // assign intensity in output image
+		}
+
+		const uchar* row = input.ptr<uchar>(cur.y);
+		for(int y = cur.y - 1; y <= cur.y + 1; y += 2) // rows above and below
+		{
+			if(y < 0 || y >= input.rows)
 			{
-				int curIntensity = input.at<uchar>(curPoint);
-				int adjIntensity = input.at<uchar>(adj);
+				continue;
+			}
 
-				checkAndAssign(adj, adjIntensity, curIntensity, seedIntensity, regionIntensity, output, &q);
+			const uchar* adj = input.ptr<uchar>(y);
+			const uchar* seen = visited->ptr<uchar>(y);
+			int first = max(cur.left - (CONNECTIVITY == 8), 0), last = min(cur.right + (CONNECTIVITY == 8), input.cols - 1); // diagonal neighbours reach one further
+			for(int x = first; x <= last; x++)
+			{
+				if(seen[x])
+				{
+					continue;
+				}
+				for(int d = 0; d < pixelGrid::NUM_NEIGHBOURS; d++) // from every pixel of the span that (x, y) is a neighbour of
+				{
+					int from = x - pixelGrid::dx(d);
+					if(pixelGrid::dy(d) == y - cur.y && from >= cur.left && from <= cur.right && accepted(adj[x], row[from], seedIntensity))
+					{
+						span next = fillSpan(input, visited, x, y, seedIntensity);
+						spans.push_back(next);
+						x = next.right; // the rest of that span is visited now
+						break;
+					}
+				}
 			}
 		}
 	}
 }
 
-Point neighbour(Point input, int direction, int cols, int rows) // calculates neighbour based on direction input
+span fillSpan(const Mat& input, Mat* visited, int x, int y, int seedIntensity) // marks and returns the span through (x, y), which joins the region
+{
+	const uchar* row = input.ptr<uchar>(y);
+	uchar* seen = visited->ptr<uchar>(y);
+
+	span s;
+	s.y = y;
+	s.left = x;
+	s.right = x;
+	seen[x] = 1;
+
+	while(s.left > 0 && !seen[s.left - 1] && accepted(row[s.left - 1], row[s.left], seedIntensity))
+	{
+		seen[--s.left] = 1;
+	}
+	while(s.right < input.cols - 1 && !seen[s.right + 1] && accepted(row[s.right + 1], row[s.right], seedIntensity))
+	{
+		seen[++s.right] = 1;
+	}
+	INSTRUMENT_COUNT(COUNTER_PIXELS_ENQUEUED, s.right - s.left + 1);
+
+	return s;
+}
+
+bool accepted(int adjIntensity, int curIntensity, int seedIntensity)
+{
+	// if all intensity constraints are satisfied
+	return adjIntensity < curIntensity + ADJACENCY_RANGE && adjIntensity > curIntensity - ADJACENCY_RANGE && adjIntensity < seedIntensity + SEED_RANGE && adjIntensity > seedIntensity - SEED_RANGE;
+}
+
+void colourComponents(const Mat& labels, int componentCount, Mat* output) // background stays black
+{
+	vector<Vec3b> palette(componentCount + 1, Vec3b(0, 0, 0));
+	for(int k = 1; k <= componentCount; k++)
+	{
+		unsigned int hash = (unsigned int)k * 2654435761u; // Knuth's multiplicative hash spreads consecutive labels over the colour cube
+		palette[k] = Vec3b((uchar)((hash >> 8) | 32), (uchar)((hash >> 16) | 32), (uchar)((hash >> 24) | 32));
+	}
+
+	for(int i = 0; i < labels.rows; i++)
+	{
+		const int* label = labels.ptr<int>(i);
+		Vec3b* out = output->ptr<Vec3b>(i);
+		for(int j = 0; j < labels.cols; j++)
+		{
+			out[j] = palette[label[j]];
+		}
+	}
+}
+
+// batch mode: every image is labelled on one thread, the images in parallel; the label map is written to "<image path>.ccl.png",
+// or for PGM, PPM and raw input into a mapped "<image path>.ccl.pgm" (".ppm" for more than 65535 labels)
+
+struct cclJob
 {
-	switch(direction)
+	string path;
+	MappedImage mapped; // set for PGM, PPM and raw input; gray may be a view of it
+	Mat gray;
+	vector<int> seeds; // pixel indices, parallel growing only
+	Mat labels;
+	int count;
+};
+
+int runBatch(int argc, char** argv)
+{
+	if(argc < 4)
+	{
+		cout << "Usage : ./ccl batch <directory or list file> <threshold>|parallel [threads]" << endl;
+		return 0;
+	}
+
+	string input(argv[2]);
+	bool parallel = string(argv[3]) == "parallel"; // seeds from "<image path>.seeds.csv" or ".seeds.json"
+	int level = atoi(argv[3]);
+	int threads = argc >= 5 ? atoi(argv[4]) : (int)thread::hardware_concurrency();
+
+	INSTRUMENT_REPORT(input + ".stats.json");
+
+	vector<string> paths;
+	if(!BatchPipeline::listImages(input, &paths))
+	{
+		cout << "Could not read " << input << endl;
+		return 1;
+	}
+
+	int failures = BatchPipeline::run<cclJob>(paths, threads, [&](const string& path, cclJob* job)
+	{
+		job->path = path;
+		if(!readGray(path, &job->mapped, &job->gray))
+		{
+			cout << "Could not read " << path << endl;
+			return false;
+		}
+
+		if(parallel)
+		{
+			vector<seedPoint> seeds;
+			if(!SidecarSeeds::read(path, &seeds))
+			{
+				cout << "No seeds for " << path << endl;
+				return false;
+			}
+			for(size_t k = 0; k < seeds.size(); k++)
+			{
+				if(seeds[k].x >= 0 && seeds[k].x < job->gray.cols && seeds[k].y >= 0 && seeds[k].y < job->gray.rows)
+				{
+					job->seeds.push_back(seeds[k].y * job->gray.cols + seeds[k].x);
+				}
+			}
+		}
+		return true;
+	}, [&](cclJob* job)
 	{
-		case N:
+		const Mat& gray = job->gray;
+		job->labels = Mat(gray.rows, gray.cols, CV_32SC1);
+		if(parallel)
 		{
-			input.y--;
-			break;
+			ConcurrentRegionGrowing<CONNECTIVITY>::grow(gray.ptr<uchar>(0), gray.step, gray.rows, gray.cols, ADJACENCY_RANGE, SEED_RANGE, job->seeds, job->labels.ptr<int>(0), job->labels.step / sizeof(int), 1);
+			job->count = (int)job->seeds.size();
+			return;
 		}
 
-		case NE:
+		Mat mask;
+		threshold(gray, mask, level, 255, THRESH_BINARY);
+		job->count = BlockLabelling::label(mask.ptr<uchar>(0), mask.step, mask.rows, mask.cols, job->labels.ptr<int>(0), job->labels.step / sizeof(int), 1);
+	}, [&](cclJob* job)
+	{
+		string path;
+		if(job->mapped.data != NULL) // PNM in, PNM out: the labels are stored straight into the mapped file
 		{
-			input.x++;
-			input.y--;
-			break;
+			if(!MappedOutput::writeLabels(job->path + ".ccl", job->labels.ptr<int>(0), job->labels.step / sizeof(int), job->labels.rows, job->labels.cols, job->count, &path))
+			{
+				cout << "Could not write " << path << endl;
+				return false;
+			}
+			return true;
 		}
 
-		case E:
+		Mat image;
+		labelImage(job->labels, job->count, &image);
+		path = job->path + ".ccl.png";
+		if(!imwrite(path, image))
 		{
-			input.x++;
-			break;
+			cout << "Could not write " << path << endl;
+			return false;
 		}
+		return true;
+	});
+
+	cout << paths.size() - failures << " of " << paths.size() << " images labelled" << endl;
+	return failures == 0 ? 0 : 1;
+}
+
+// server mode: "serve <socket path> [threads]" answers requests with "threshold=<level>" (labelling, the default with level 128) or
+// "parallel" and seeds (growing) with the label map: 0 for the background, components or regions from 1
+
+struct cclWorker // everything a request needs, kept from one request to the next
+{
+	MappedImage mapped;
+	Mat gray, mask, labels;
+	vector<int> seeds;
+	int count;
+};
+
+int runServer(int argc, char** argv)
+{
+	if(argc < 3)
+	{
+		cout << "Usage : ./ccl serve <socket path> [threads]" << endl;
+		return 0;
+	}
+	int threads = argc >= 4 ? atoi(argv[3]) : (int)thread::hardware_concurrency();
 
-		case SE:
+	cout << "Listening on " << argv[2] << endl;
+	bool served = SegmentationServer::run<cclWorker>(argv[2], threads, [&](const serverRequest& request, cclWorker* worker, string* error)
+	{
+		if(!readRequest(request, &worker->mapped, &worker->gray))
 		{
-			input.x++;
-			input.y++;
-			break;
+			*error = "could not read the image";
+			return false;
 		}
 
-		case S:
+		worker->seeds.clear();
+		for(size_t k = 0; k < request.seeds.size(); k++)
+		{
+			if(request.seeds[k].x >= 0 && request.seeds[k].x < worker->gray.cols && request.seeds[k].y >= 0 && request.seeds[k].y < worker->gray.rows)
+			{
+				worker->seeds.push_back(request.seeds[k].y * worker->gray.cols + request.seeds[k].x);
+			}
+		}
+		if(request.has("parallel") && worker->seeds.empty())
+		{
+			*error = "expected seed=<x>,<y> in the image";
+			return false;
+		}
+		return true;
+	}, [&](const serverRequest& request, cclWorker* worker, serverResponse* response)
+	{
+		const Mat& gray = worker->gray;
+		worker->labels.create(gray.rows, gray.cols, CV_32SC1);
+		if(request.has("parallel"))
+		{
+			ConcurrentRegionGrowing<CONNECTIVITY>::grow(gray.ptr<uchar>(0), gray.step, gray.rows, gray.cols, ADJACENCY_RANGE, SEED_RANGE, worker->seeds, worker->labels.ptr<int>(0), worker->labels.step / sizeof(int), 1);
+			worker->count = (int)worker->seeds.size();
+		}
+		else
 		{
-			input.y++;
-			break;
+			threshold(gray, worker->mask, atoi(request.value("threshold", "128").c_str()), 255, THRESH_BINARY);
+			worker->count = BlockLabelling::label(worker->mask.ptr<uchar>(0), worker->mask.step, gray.rows, gray.cols, worker->labels.ptr<int>(0), worker->labels.step / sizeof(int), 1);
 		}
 
-		case SW:
+		response->type = "labels";
+		response->rows = gray.rows;
+		response->cols = gray.cols;
+		response->count = worker->count;
+		response->data.resize((size_t)gray.rows * gray.cols * sizeof(int));
+		for(int i = 0; i < gray.rows; i++)
 		{
-			input.x--;
-			input.y++;
-			break;
+			memcpy(&response->data[(size_t)i * gray.cols * sizeof(int)], worker->labels.ptr<int>(i), gray.cols * sizeof(int));
 		}
+	});
+
+	if(!served)
+	{
+		cout << "Could not listen on " << argv[2] << endl;
+		return 1;
+	}
+	return 0;
+}
+
+void labelImage(const Mat& labels, int count, Mat* image) // 16 bit gray if the labels fit, otherwise 24 bit labels in B G R (B lowest)
+{
+	if(count < 65536)
+	{
+		labels.convertTo(*image, CV_16UC1);
+		return;
+	}
 
-		case W:
+	*image = Mat(labels.rows, labels.cols, CV_8UC3);
+	for(int i = 0; i < labels.rows; i++)
+	{
+		const int* label = labels.ptr<int>(i);
+		Vec3b* out = image->ptr<Vec3b>(i);
+		for(int j = 0; j < labels.cols; j++)
 		{
-			input.x--;
-			break;
+			out[j] = Vec3b((uchar)label[j], (uchar)(label[j] >> 8), (uchar)(label[j] >> 16));
 		}
+	}
+}
 
-		case NW:
+bool readGray(const string& path, MappedImage* mapped, Mat* gray) // 8 bit PGM, PPM and raw files are mapped and used without decoding, others are decoded
+{
+	*gray = Mat(); // never convert into a view of the previous mapping
+	if(mapped->open(path))
+	{
+		Mat view(mapped->rows, mapped->cols, CV_8UC(mapped->channels), (void*)mapped->data, mapped->step); // read-only
+		if(mapped->channels == 1)
+		{
+			*gray = view;
+		}
+		else
 		{
-			input.x--;
-			input.y--;
-			break;
+			cvtColor(view, *gray, COLOR_RGB2GRAY);
 		}
+		return true;
 	}
-	if(input.x < 0 || input.x >= cols || input.y < 0 || input.y >= rows)
+
+	Mat input = imread(path, IMREAD_COLOR);
+	if(input.empty())
 	{
-		return Point(-1, -1);
+		return false;
 	}
-	return input;
+	cvtColor(input, *gray, COLOR_BGR2GRAY); // convert to grayscale (weighted formula)
+	return true;
 }
 
-void checkAndAssign(Point adj, int adjIntensity, int curIntensity, int seedIntensity, Vec3b regionIntensity, Mat* output, queue<Point>* q)
+bool readRequest(const serverRequest& request, MappedImage* mapped, Mat* gray) // the image of a server request: from its file, or decoded from its bytes
 {
-	// if all intensity constraints are satisfied
-	if(adjIntensity < curIntensity + ADJACENCY_RANGE && adjIntensity > curIntensity - ADJACENCY_RANGE && adjIntensity < seedIntensity + SEED_RANGE && adjIntensity > seedIntensity - SEED_RANGE)
+	if(!request.path.empty())
 	{
-		output->at<Vec3b>(adj) = regionIntensity; // assign intensity in output image
-		q->push(adj); // enqueue this point
+		return readGray(request.path, mapped, gray);
 	}
-}
\ No newline at end of file
+
+	if(mapped->data != NULL) // the view of the previous request's file must not be written to
+	{
+		*gray = Mat();
+		mapped->close();
+	}
+	Mat decoded = imdecode(Mat(1, (int)request.bytes.size(), CV_8UC1, (void*)request.bytes.data()), IMREAD_COLOR);
+	if(decoded.empty())
+	{
+		return false;
+	}
+	cvtColor(decoded, *gray, COLOR_BGR2GRAY);
+	return true;
+}
@@ -0,0 +1,186 @@
+#ifndef CONCURRENT_REGION_GROWING_H
+#define CONCURRENT_REGION_GROWING_H
+
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+#include <limits.h>
+#include <stdlib.h>
+#include <stddef.h>
+
+#include "gridTopology.h"
+#include "instrumentation.h"
+
+// All seeds grow at once, one ring of pixels per round. A pixel joins the region of its neighbour p if it is within adjacencyRange
+// of p and within seedRange of the seed of p's region, as in the sequential growing. In every round the threads share the pixels
+// claimed in the previous round, and each of them claims its unclaimed neighbours with a compare-and-swap minimum on the label map;
+// after the round the claims are final. A pixel therefore goes to the seed that reaches it in the fewest steps and, among those,
+// to the lowest seed id: which claim lands first does not matter, so the labels are the same for any number of threads.
+
+template <int connectivity>
+class ConcurrentRegionGrowing
+{
+public:
+	// image: 8 bit, step bytes per row; seeds: pixel indices y * cols + x, seed k gets label k + 1; labels: int32, labelStep ints per row,
+	// 0 where no region grew
+	static void grow(const unsigned char* image, size_t step, int rows, int cols, int adjacencyRange, int seedRange,
+		const std::vector<int>& seeds, int* labels, size_t labelStep, int threads)
+	{
+		threads = std::max(1, std::min(threads, std::max(rows, 1)));
+		ConcurrentRegionGrowing state(image, step, rows, cols, adjacencyRange, seedRange, threads);
+
+		state.seedIntensity.push_back(0); // labels start at 1
+		for(size_t k = 0; k < seeds.size(); k++)
+		{
+			int p = seeds[k], id = (int)k + 1;
+			state.seedIntensity.push_back(image[(p / cols) * step + p % cols]);
+			if(state.label[p].load(std::memory_order_relaxed) == UNCLAIMED) // of several seeds on one pixel the first keeps it
+			{
+				state.label[p].store(id, std::memory_order_relaxed);
+				state.settled[p] = 1;
+				state.frontier[0][k % threads].push_back(p);
+				INSTRUMENT_COUNT(COUNTER_PIXELS_ENQUEUED, 1);
+			}
+		}
+
+		std::vector<std::thread> workers;
+		for(int t = 0; t < threads; t++)
+		{
+			workers.push_back(std::thread(&ConcurrentRegionGrowing::worker, &state, t, labels, labelStep));
+		}
+		for(int t = 0; t < threads; t++)
+		{
+			workers[t].join();
+		}
+	}
+
+private:
+	static const int UNCLAIMED = INT_MAX;
+
+	const unsigned char* image;
+	size_t step;
+	GridTopology<connectivity> grid;
+	int rows, cols, adjacencyRange, seedRange, threads;
+	std::vector<int> seedIntensity;
+	std::vector<std::atomic<int>> label; // seed id, or UNCLAIMED
+	std::vector<unsigned char> settled; // claimed in an earlier round: the label is final
+	std::vector<std::vector<int>> frontier[2]; // pixels claimed in the last round, one list per thread
+
+	std::mutex lock; // round barrier
+	std::condition_variable roundDone;
+	int waiting, generation;
+
+	ConcurrentRegionGrowing(const unsigned char* image, size_t step, int rows, int cols, int adjacencyRange, int seedRange, int threads) :
+		image(image), step(step), grid(rows, cols), rows(rows), cols(cols), adjacencyRange(adjacencyRange), seedRange(seedRange), threads(threads),
+		label((size_t)rows * cols), settled((size_t)rows * cols, 0), waiting(0), generation(0)
+	{
+		for(size_t p = 0; p < label.size(); p++)
+		{
+			label[p].store(UNCLAIMED, std::memory_order_relaxed);
+		}
+		frontier[0].resize(threads);
+		frontier[1].resize(threads);
+	}
+
+	void barrier()
+	{
+		std::unique_lock<std::mutex> guard(lock);
+		int round = generation;
+		if(++waiting == threads)
+		{
+			waiting = 0;
+			generation++;
+			roundDone.notify_all();
+			return;
+		}
+		roundDone.wait(guard, [&]{ return generation != round; });
+	}
+
+	int intensity(int p) const
+	{
+		return image[(p / cols) * step + p % cols];
+	}
+
+	void claim(int q, int cur, int id, std::vector<int>* claimed) // q: neighbour of a pixel with intensity cur in region id
+	{
+		if(settled[q])
+		{
+			return;
+		}
+		int adj = intensity(q);
+		if(abs(adj - cur) >= adjacencyRange || abs(adj - seedIntensity[id]) >= seedRange)
+		{
+			return;
+		}
+
+		int old = label[q].load(std::memory_order_relaxed);
+		while(id < old && !label[q].compare_exchange_weak(old, id, std::memory_order_relaxed))
+		{
+		}
+		if(old == UNCLAIMED) // the first claim of this round lists the pixel
+		{
+			claimed->push_back(q);
+			INSTRUMENT_COUNT(COUNTER_PIXELS_ENQUEUED, 1);
+		}
+	}
+
+	void worker(int t, int* labels, size_t labelStep)
+	{
+		int cur = 0;
+
+		while(true)
+		{
+			size_t total = 0;
+			for(int k = 0; k < threads; k++)
+			{
+				total += frontier[cur][k].size();
+			}
+			if(total == 0)
+			{
+				break;
+			}
+
+			size_t begin = total * t / threads, end = total * (t + 1) / threads, offset = 0; // this thread's share of the frontier
+			std::vector<int>* claimed = &frontier[1 - cur][t];
+			for(int k = 0; k < threads && offset < end; k++)
+			{
+				const std::vector<int>& list = frontier[cur][k];
+				for(size_t g = std::max(begin, offset); g < std::min(end, offset + list.size()); g++)
+				{
+					int p = list[g - offset];
+					int id = label[p].load(std::memory_order_relaxed), value = intensity(p);
+					grid.forEachNeighbour(p % cols, p / cols, [&](int q, int /*d*/)
+					{
+						claim(q, value, id, claimed);
+					});
+				}
+				offset += list.size();
+			}
+
+			barrier(); // every claim of the round is in
+
+			for(size_t k = 0; k < claimed->size(); k++)
+			{
+				settled[(*claimed)[k]] = 1;
+			}
+			frontier[cur][t].clear();
+			cur = 1 - cur;
+
+			barrier(); // the next frontier is complete
+		}
+
+		for(int y = (int)((long long)rows * t / threads); y < (int)((long long)rows * (t + 1) / threads); y++)
+		{
+			for(int x = 0; x < cols; x++)
+			{
+				int id = label[y * cols + x].load(std::memory_order_relaxed);
+				labels[y * labelStep + x] = id == UNCLAIMED ? 0 : id;
+			}
+		}
+	}
+};
+
+#endif
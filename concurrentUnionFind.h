@@ -0,0 +1,82 @@
+#ifndef CONCURRENT_UNION_FIND_H
+#define CONCURRENT_UNION_FIND_H
+
+#include <vector>
+#include <atomic>
+#include <algorithm>
+
+#include "instrumentation.h"
+
+// Lock-free disjoint sets over 0 .. size-1 ("Wait-free Parallel Algorithms for the Union-Find Problem", Anderson and Woll, STOC 1991).
+// A root is only ever linked below a root with a smaller index, with one compare-and-swap, so the forest stays acyclic under
+// concurrent unite() calls and the root of every set is its smallest element. find() halves paths with compare-and-swap too;
+// a failed halving step only means another thread shortened the path first.
+
+class ConcurrentUnionFind
+{
+public:
+	ConcurrentUnionFind(int size) : parent(size)
+	{
+		for(int p = 0; p < size; p++)
+		{
+			parent[p].store(p, std::memory_order_relaxed);
+		}
+	}
+
+	int size() const
+	{
+		return (int)parent.size();
+	}
+
+	int find(int p)
+	{
+		INSTRUMENT_COUNT(COUNTER_FINDS, 1);
+		while(true)
+		{
+			int q = parent[p].load(std::memory_order_relaxed);
+			if(q == p)
+			{
+				return p;
+			}
+			int r = parent[q].load(std::memory_order_relaxed);
+			if(q != r)
+			{
+				parent[p].compare_exchange_weak(q, r, std::memory_order_relaxed); // path halving
+			}
+			p = r;
+		}
+	}
+
+	bool unite(int a, int b) // false if a and b were already in the same set
+	{
+		while(true)
+		{
+			a = find(a);
+			b = find(b);
+			if(a == b)
+			{
+				return false;
+			}
+			if(a < b)
+			{
+				std::swap(a, b);
+			}
+			int expected = a;
+			if(parent[a].compare_exchange_strong(expected, b)) // fails if a stopped being a root meanwhile
+			{
+				INSTRUMENT_COUNT(COUNTER_UNIONS, 1);
+				return true;
+			}
+		}
+	}
+
+	int parentOf(int p) const // once all unite() calls are done
+	{
+		return parent[p].load(std::memory_order_relaxed);
+	}
+
+private:
+	std::vector<std::atomic<int>> parent;
+};
+
+#endif
@@ -0,0 +1,213 @@
+#ifndef EDGE_WEIGHTS_H
+#define EDGE_WEIGHTS_H
+
+#include <stdlib.h>
+#include <math.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define EDGE_WEIGHTS_SIMD
+#include <immintrin.h>
+#endif
+
+// Row kernels for 8 bit edge weights: out[x] = distance between pixel x of row a and pixel x of row b, for n pixels of 1 byte
+// (gray) or 3 interleaved bytes (colour), so the rows of a decoded or converted image are read in place.
+// An edge direction is a pair of row pointers (e.g. the current row shifted by one and the previous row for NW), so one call
+// computes the weights of a whole row of edges. On x86 every build contains AVX2 and SSE4.1 versions (compiled for their targets
+// with function attributes, so no -m flags are needed) and the first call picks the best one the CPU supports; the scalar loop
+// handles the rest of the row and every other CPU. All paths give the same bytes.
+
+enum simdLevel
+{
+	SIMD_NONE = 0, SIMD_SSE41, SIMD_AVX2
+};
+
+inline int detectSimdLevel()
+{
+#if defined(EDGE_WEIGHTS_SIMD)
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2") ? SIMD_AVX2 : __builtin_cpu_supports("sse4.1") ? SIMD_SSE41 : SIMD_NONE;
+#else
+	return SIMD_NONE;
+#endif
+}
+
+inline int cpuSimdLevel() // detected once per process
+{
+	static const int level = detectSimdLevel();
+	return level;
+}
+
+inline void absDiffScalar(const unsigned char* a, const unsigned char* b, unsigned char* out, int x, int n) // pixels x .. n - 1
+{
+	for(; x < n; x++)
+	{
+		out[x] = (unsigned char)abs(a[x] - b[x]);
+	}
+}
+
+inline void euclideanScalar(const unsigned char* a, const unsigned char* b, unsigned char* out, int x, int n)
+{
+	for(; x < n; x++)
+	{
+		int sum = 0;
+		for(int c = 3 * x; c < 3 * x + 3; c++)
+		{
+			sum += (a[c] - b[c]) * (a[c] - b[c]);
+		}
+		out[x] = (unsigned char)(int)(sqrtf((float)sum * (1.0f / 3)) + 0.5f);
+	}
+}
+
+#if defined(EDGE_WEIGHTS_SIMD)
+
+__attribute__((target("sse4.1"))) inline int absDiffSse41(const unsigned char* a, const unsigned char* b, unsigned char* out, int x, int n) // returns the first pixel left
+{
+	for(; x + 16 <= n; x += 16)
+	{
+		__m128i va = _mm_loadu_si128((const __m128i*)(a + x)), vb = _mm_loadu_si128((const __m128i*)(b + x));
+		_mm_storeu_si128((__m128i*)(out + x), _mm_or_si128(_mm_subs_epu8(va, vb), _mm_subs_epu8(vb, va)));
+	}
+	return x;
+}
+
+__attribute__((target("avx2"))) inline int absDiffAvx2(const unsigned char* a, const unsigned char* b, unsigned char* out, int n)
+{
+	int x = 0;
+	for(; x + 32 <= n; x += 32)
+	{
+		__m256i va = _mm256_loadu_si256((const __m256i*)(a + x)), vb = _mm256_loadu_si256((const __m256i*)(b + x));
+		_mm256_storeu_si256((__m256i*)(out + x), _mm256_or_si256(_mm256_subs_epu8(va, vb), _mm256_subs_epu8(vb, va)));
+	}
+	return x;
+}
+
+// colour: the absolute differences of 16 interleaved pixels (3 registers) are split into one register per channel with byte
+// shuffles, pixel x of channel c being byte 3x + c
+__attribute__((target("sse4.1"))) inline void absDiffPixels(const unsigned char* a, const unsigned char* b, __m128i channel[3])
+{
+	static const signed char order[3][3][16] = {
+		{{0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1}, {-1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14, -1, -1, -1, -1, -1}, {-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 1, 4, 7, 10, 13}},
+		{{1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1}, {-1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1}, {-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14}},
+		{{2, 5, 8, 11, 14, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1}, {-1, -1, -1, -1, -1, 1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1}, {-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15}}};
+
+	__m128i d[3];
+	for(int k = 0; k < 3; k++)
+	{
+		__m128i va = _mm_loadu_si128((const __m128i*)(a + 16 * k)), vb = _mm_loadu_si128((const __m128i*)(b + 16 * k));
+		d[k] = _mm_or_si128(_mm_subs_epu8(va, vb), _mm_subs_epu8(vb, va));
+	}
+	for(int c = 0; c < 3; c++)
+	{
+		channel[c] = _mm_setzero_si128();
+		for(int k = 0; k < 3; k++)
+		{
+			channel[c] = _mm_or_si128(channel[c], _mm_shuffle_epi8(d[k], _mm_loadu_si128((const __m128i*)order[c][k])));
+		}
+	}
+}
+
+__attribute__((target("sse4.1"))) inline __m128i roundedDistance(__m128i sum) // round(sqrt(sum / 3)) of 4 pixels
+{
+	return _mm_cvttps_epi32(_mm_add_ps(_mm_sqrt_ps(_mm_mul_ps(_mm_cvtepi32_ps(sum), _mm_set1_ps(1.0f / 3))), _mm_set1_ps(0.5f)));
+}
+
+__attribute__((target("sse4.1"))) inline int euclideanSse41(const unsigned char* a, const unsigned char* b, unsigned char* out, int x, int n)
+{
+	for(; x + 16 <= n; x += 16)
+	{
+		__m128i channel[3], sum[4];
+		absDiffPixels(a + 3 * x, b + 3 * x, channel);
+		for(int q = 0; q < 4; q++)
+		{
+			sum[q] = _mm_setzero_si128();
+		}
+		for(int c = 0; c < 3; c++)
+		{
+			__m128i lo = _mm_cvtepu8_epi16(channel[c]), hi = _mm_cvtepu8_epi16(_mm_srli_si128(channel[c], 8));
+			__m128i squareLo = _mm_mullo_epi16(lo, lo), squareHi = _mm_mullo_epi16(hi, hi);
+			sum[0] = _mm_add_epi32(sum[0], _mm_cvtepu16_epi32(squareLo));
+			sum[1] = _mm_add_epi32(sum[1], _mm_cvtepu16_epi32(_mm_srli_si128(squareLo, 8)));
+			sum[2] = _mm_add_epi32(sum[2], _mm_cvtepu16_epi32(squareHi));
+			sum[3] = _mm_add_epi32(sum[3], _mm_cvtepu16_epi32(_mm_srli_si128(squareHi, 8)));
+		}
+		__m128i lo = _mm_packus_epi32(roundedDistance(sum[0]), roundedDistance(sum[1]));
+		__m128i hi = _mm_packus_epi32(roundedDistance(sum[2]), roundedDistance(sum[3]));
+		_mm_storeu_si128((__m128i*)(out + x), _mm_packus_epi16(lo, hi));
+	}
+	return x;
+}
+
+__attribute__((target("avx2"))) inline int euclideanAvx2(const unsigned char* a, const unsigned char* b, unsigned char* out, int n)
+{
+	const __m256 third = _mm256_set1_ps(1.0f / 3), half = _mm256_set1_ps(0.5f);
+	int x = 0;
+	for(; x + 16 <= n; x += 16)
+	{
+		__m128i channel[3];
+		absDiffPixels(a + 3 * x, b + 3 * x, channel);
+		__m256i sumLo = _mm256_setzero_si256(), sumHi = _mm256_setzero_si256();
+		for(int c = 0; c < 3; c++)
+		{
+			__m256i d = _mm256_cvtepu8_epi16(channel[c]);
+			__m256i square = _mm256_mullo_epi16(d, d); // at most 255^2: fits in 16 bits unsigned
+			sumLo = _mm256_add_epi32(sumLo, _mm256_cvtepu16_epi32(_mm256_castsi256_si128(square)));
+			sumHi = _mm256_add_epi32(sumHi, _mm256_cvtepu16_epi32(_mm256_extracti128_si256(square, 1)));
+		}
+		__m256i lo = _mm256_cvttps_epi32(_mm256_add_ps(_mm256_sqrt_ps(_mm256_mul_ps(_mm256_cvtepi32_ps(sumLo), third)), half));
+		__m256i hi = _mm256_cvttps_epi32(_mm256_add_ps(_mm256_sqrt_ps(_mm256_mul_ps(_mm256_cvtepi32_ps(sumHi), third)), half));
+		__m256i words = _mm256_permute4x64_epi64(_mm256_packus_epi32(lo, hi), 0xD8); // packing works per 128 bit lane
+		_mm_storeu_si128((__m128i*)(out + x), _mm_packus_epi16(_mm256_castsi256_si128(words), _mm256_extracti128_si256(words, 1)));
+	}
+	return x;
+}
+
+#endif
+
+inline void absDiffRow(const unsigned char* a, const unsigned char* b, unsigned char* out, int n) // grayscale: |a - b|
+{
+	int x = 0;
+#if defined(EDGE_WEIGHTS_SIMD)
+	int level = cpuSimdLevel();
+	if(level == SIMD_AVX2)
+	{
+		x = absDiffAvx2(a, b, out, n);
+	}
+	if(level >= SIMD_SSE41)
+	{
+		x = absDiffSse41(a, b, out, x, n);
+	}
+#endif
+	absDiffScalar(a, b, out, x, n);
+}
+
+// three interleaved channels: Euclidean distance scaled to 0..255, i.e. round(sqrt((d0^2 + d1^2 + d2^2) / 3))
+inline void euclideanRow(const unsigned char* a, const unsigned char* b, unsigned char* out, int n)
+{
+	int x = 0;
+#if defined(EDGE_WEIGHTS_SIMD)
+	int level = cpuSimdLevel();
+	if(level == SIMD_AVX2)
+	{
+		x = euclideanAvx2(a, b, out, n);
+	}
+	if(level >= SIMD_SSE41)
+	{
+		x = euclideanSse41(a, b, out, x, n);
+	}
+#endif
+	euclideanScalar(a, b, out, x, n);
+}
+
+inline void distanceRow(const unsigned char* a, const unsigned char* b, int channels, unsigned char* out, int n) // 1 or 3 channels
+{
+	if(channels == 3)
+	{
+		euclideanRow(a, b, out, n);
+	}
+	else
+	{
+		absDiffRow(a, b, out, n);
+	}
+}
+
+#endif
@@ -0,0 +1,149 @@
+#ifndef GRID_GRAPH_H
+#define GRID_GRAPH_H
+
+#include <vector>
+#include <algorithm>
+#include <stddef.h>
+
+#include "capacityTraits.h"
+#include "gridTopology.h"
+#include "weightModels.h"
+#include "edgeWeights.h"
+
+// Residual network over a pixel grid with 4-connectivity.
+// Pixels are addressed by their flat index p = y*cols + x and the neighbours of a pixel are implicit from that index,
+// so every arc is identified by (pixel, direction) and capacities/flows live in one flat array per direction.
+// Saturated arcs are never removed; an arc is usable while capacity - flow > 0.
+// Edges are undirected (capacity[d][p] == capacity[reverse(d)][neighbour(p, d)]); terminal links are kept as one net residual per pixel.
+// The capacity type is a template parameter (see capacityTraits.h): with uint16_t capacities an arc takes 4 bytes instead of 8.
+
+class GridLayout : public GridTopology<4> // indexing shared by every capacity type
+{
+public:
+	enum arcDirection // reverse(d) == d ^ 2
+	{
+		ARC_N = GRID_N, ARC_E = GRID_E, ARC_S = GRID_S, ARC_W = GRID_W, NUM_ARCS = NUM_NEIGHBOURS
+	};
+
+	GridLayout(int rows, int cols) : GridTopology<4>(rows, cols) {}
+
+	int arcTo(int p, int q) const // direction of the arc from p to its neighbour q
+	{
+		int diff = q - p; // vertical first: in a grid one pixel wide, +-cols and +-1 are the same and only N and S arcs exist
+		return diff == -cols ? ARC_N : diff == cols ? ARC_S : diff == 1 ? ARC_E : ARC_W;
+	}
+};
+
+template <typename capType>
+class GridGraph : public GridLayout
+{
+public:
+	typedef capacityTraits<capType> traits;
+	typedef typename traits::flowType flowType;
+	typedef typename traits::valueType valueType; // residuals, excesses and terminal links
+
+	std::vector<capType> capacity[NUM_ARCS]; // capacity[d][p]: capacity of the arc from p to its neighbour in direction d (0 if the neighbour is outside the grid)
+	std::vector<flowType> flow[NUM_ARCS]; // skew symmetric: flow[d][p] == -flow[reverse(d)][neighbour(p, d)]
+	std::vector<valueType> terminal; // net residual terminal capacity of p: > 0 from the source to p, < 0 from p to the sink
+
+	GridGraph(int rows, int cols) : GridLayout(rows, cols)
+	{
+		reset(rows, cols);
+	}
+
+	void reset(int rows, int cols) // empty graph of the given size; the arrays keep their memory, so a graph can be reused without allocating
+	{
+		this->rows = rows;
+		this->cols = cols;
+		for(int d = 0; d < NUM_ARCS; d++)
+		{
+			capacity[d].assign((size_t)rows * cols, 0);
+			flow[d].assign((size_t)rows * cols, 0);
+		}
+		terminal.assign((size_t)rows * cols, 0);
+	}
+
+	// arc capacities from an 8 bit image with 1 or 3 (interleaved) channels, step bytes per row: the distances of a row of arcs come
+	// from one row kernel call (gray difference, or colour distance if table.colour) and are turned into capacities by the table
+	void build(const WeightTable<capType>& table, const unsigned char* image, size_t step, int channels)
+	{
+		int used = table.colour && channels == 3 ? 3 : 1; // channels the distance reads
+		std::vector<unsigned char> current, previous, distance(cols);
+		if(used != channels)
+		{
+			current.resize(cols);
+			previous.resize(cols);
+		}
+
+		for(int y = 0; y < rows; y++)
+		{
+			const unsigned char* cur = image + y * step; // the rows themselves
+			const unsigned char* prev = y > 0 ? cur - step : cur;
+
+			if(used != channels) // the gray model on colour pixels uses the first channel
+			{
+				for(int x = 0; x < cols; x++)
+				{
+					current[x] = cur[x * channels];
+				}
+				cur = current.data();
+				prev = previous.data();
+			}
+
+			int p = y * cols;
+			distanceRow(cur, cur + used, used, distance.data(), cols - 1); // to the east
+			for(int x = 0; x + 1 < cols; x++)
+			{
+				capType weight = table.byDistance[distance[x]];
+				capacity[ARC_E][p + x] = weight;
+				capacity[ARC_W][p + x + 1] = weight;
+			}
+
+			if(y > 0) // to the north
+			{
+				distanceRow(cur, prev, used, distance.data(), cols);
+				for(int x = 0; x < cols; x++)
+				{
+					capType weight = table.byDistance[distance[x]];
+					capacity[ARC_N][p + x] = weight;
+					capacity[ARC_S][p + x - cols] = weight;
+				}
+			}
+
+			current.swap(previous);
+		}
+	}
+
+	bool hasArc(int p, int d) const // arc exists in the original graph
+	{
+		return capacity[d][p] > 0;
+	}
+
+	valueType residual(int p, int d) const
+	{
+		return (valueType)capacity[d][p] - flow[d][p];
+	}
+
+	bool unsaturated(int p, int d) const
+	{
+		return traits::positive(residual(p, d));
+	}
+
+	valueType netOutflow(int p) const // flow leaving p through its arcs minus flow entering it
+	{
+		valueType outflow = 0;
+		for(int d = 0; d < NUM_ARCS; d++)
+		{
+			outflow += flow[d][p];
+		}
+		return outflow;
+	}
+
+	void push(int p, int d, valueType amount) // send "amount" units along arc (p, d); the reverse arc gains the same residual capacity
+	{
+		flow[d][p] += (flowType)amount;
+		flow[reverse(d)][neighbour(p, d)] -= (flowType)amount;
+	}
+};
+
+#endif
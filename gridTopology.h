@@ -0,0 +1,131 @@
+#ifndef GRID_TOPOLOGY_H
+#define GRID_TOPOLOGY_H
+
+// Neighbourhood of a pixel grid, shared by the region growing, the segmentation and the max-flow graphs.
+// Directions are numbered so that the 4-neighbourhood is a prefix of the 8-neighbourhood and the opposite of d is always d ^ 2:
+//
+//	N E S W NE SE SW NW
+//
+// The connectivity is a template parameter: loops over the neighbours have a constant trip count and read constant offset tables,
+// so the compiler can unroll them. A pixel is interior when all of its neighbours are inside the grid; scan() visits the interior
+// and the border separately so that only border pixels pay for bounds checks. (6- and 26-connectivity need a third axis.)
+
+enum gridDirection
+{
+	GRID_N = 0, GRID_E, GRID_S, GRID_W, GRID_NE, GRID_SE, GRID_SW, GRID_NW
+};
+
+template <typename unused = void>
+struct gridOffsets // a template only so that the tables can be defined in this header
+{
+	static constexpr int dx[8] = {0, 1, 0, -1, 1, 1, -1, -1};
+	static constexpr int dy[8] = {-1, 0, 1, 0, -1, 1, 1, -1};
+};
+
+template <typename unused> constexpr int gridOffsets<unused>::dx[8];
+template <typename unused> constexpr int gridOffsets<unused>::dy[8];
+
+template <int connectivity>
+class GridTopology
+{
+	static_assert(connectivity == 4 || connectivity == 8, "a 2D grid has 4- or 8-connectivity");
+
+public:
+	static const int NUM_NEIGHBOURS = connectivity;
+
+	int rows, cols;
+
+	GridTopology(int rows, int cols) : rows(rows), cols(cols) {}
+
+	int size() const
+	{
+		return rows * cols;
+	}
+
+	int index(int x, int y) const
+	{
+		return y * cols + x;
+	}
+
+	static constexpr int reverse(int d)
+	{
+		return d ^ 2;
+	}
+
+	static constexpr int dx(int d)
+	{
+		return gridOffsets<>::dx[d];
+	}
+
+	static constexpr int dy(int d)
+	{
+		return gridOffsets<>::dy[d];
+	}
+
+	int offset(int d) const // flat index difference to the neighbour in direction d
+	{
+		return dy(d) * cols + dx(d);
+	}
+
+	bool contains(int x, int y) const
+	{
+		return x >= 0 && x < cols && y >= 0 && y < rows;
+	}
+
+	bool interior(int x, int y) const
+	{
+		return x > 0 && x < cols - 1 && y > 0 && y < rows - 1;
+	}
+
+	int neighbour(int p, int d) const // only valid for neighbours inside the grid
+	{
+		return p + offset(d);
+	}
+
+	template <typename function>
+	void forEachNeighbour(int x, int y, function f) const // f(q, d) for every neighbour q inside the grid
+	{
+		int p = index(x, y);
+		if(interior(x, y))
+		{
+			for(int d = 0; d < NUM_NEIGHBOURS; d++)
+			{
+				f(p + offset(d), d);
+			}
+			return;
+		}
+		for(int d = 0; d < NUM_NEIGHBOURS; d++)
+		{
+			if(contains(x + dx(d), y + dy(d)))
+			{
+				f(p + offset(d), d);
+			}
+		}
+	}
+
+	template <typename interiorFunction, typename borderFunction>
+	void scan(int begin, int end, interiorFunction inner, borderFunction border) const // rows [begin, end): inner(p, x, y) or border(p, x, y)
+	{
+		for(int y = begin; y < end; y++)
+		{
+			int p = y * cols;
+			if(y == 0 || y == rows - 1 || cols < 3)
+			{
+				for(int x = 0; x < cols; x++)
+				{
+					border(p + x, x, y);
+				}
+				continue;
+			}
+
+			border(p, 0, y);
+			for(int x = 1; x < cols - 1; x++)
+			{
+				inner(p + x, x, y);
+			}
+			border(p + cols - 1, cols - 1, y);
+		}
+	}
+};
+
+#endif
@@ -0,0 +1,142 @@
+#ifndef INSTRUMENTATION_H
+#define INSTRUMENTATION_H
+
+// Phase timers and solver counters, written as JSON at the end of a run. Compiled in with -DINSTRUMENTATION (cmake -DINSTRUMENTATION=ON);
+// otherwise every macro below expands to nothing and its arguments are not evaluated, so the hot paths are unchanged.
+//
+//	INSTRUMENT_BEGIN(PHASE_SOLVE) ... INSTRUMENT_END(PHASE_SOLVE)	time between the two, summed over all calls
+//	INSTRUMENT_COUNT(COUNTER_FINDS, 1)				add to a counter; every thread has its own copy, summed in the report
+//	INSTRUMENT_REPORT(path)						write the report to path when the enclosing scope ends
+
+enum instrumentationPhase
+{
+	PHASE_DECODE = 0, PHASE_GRAPH_BUILD, PHASE_SOLVE, PHASE_CUT_EXTRACTION, PHASE_RENDER, NUM_PHASES
+};
+
+enum instrumentationCounter
+{
+	COUNTER_AUGMENTING_PATHS = 0, COUNTER_BFS_NODES, COUNTER_PATH_LENGTH, COUNTER_PUSHES, COUNTER_RELABELS, COUNTER_UNIONS, COUNTER_FINDS,
+	COUNTER_PIXELS_ENQUEUED, NUM_COUNTERS
+};
+
+#ifdef INSTRUMENTATION
+
+#include <vector>
+#include <mutex>
+#include <memory>
+#include <chrono>
+#include <fstream>
+#include <string>
+
+class Instrumentation
+{
+public:
+	static Instrumentation& instance()
+	{
+		static Instrumentation run;
+		return run;
+	}
+
+	static long long* threadCounters() // counters of the calling thread; they outlive it so that the report can sum them
+	{
+		thread_local long long* counters = instance().addThread();
+		return counters;
+	}
+
+	void begin(int phase)
+	{
+		started[phase] = std::chrono::steady_clock::now();
+	}
+
+	void end(int phase)
+	{
+		seconds[phase] += std::chrono::duration<double>(std::chrono::steady_clock::now() - started[phase]).count();
+		calls[phase]++;
+	}
+
+	long long total(int counter) // after the counting threads are joined
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		long long sum = 0;
+		for(size_t t = 0; t < threads.size(); t++)
+		{
+			sum += threads[t][counter];
+		}
+		return sum;
+	}
+
+	bool writeJson(const std::string& path)
+	{
+		static const char* phaseNames[NUM_PHASES] = {"decode", "graph_build", "solve", "cut_extraction", "render"};
+		static const char* counterNames[NUM_COUNTERS] = {"augmenting_paths", "bfs_nodes", "path_length", "pushes", "relabels", "unions", "finds",
+			"pixels_enqueued"};
+
+		std::ofstream out(path.c_str());
+		out << "{" << std::endl << "  \"phases\": {";
+		for(int p = 0; p < NUM_PHASES; p++)
+		{
+			out << (p ? ", " : "") << "\"" << phaseNames[p] << "\": {\"seconds\": " << seconds[p] << ", \"calls\": " << calls[p] << "}";
+		}
+		out << "}," << std::endl << "  \"counters\": {";
+		for(int c = 0; c < NUM_COUNTERS; c++)
+		{
+			out << (c ? ", " : "") << "\"" << counterNames[c] << "\": " << total(c);
+		}
+		long long paths = total(COUNTER_AUGMENTING_PATHS);
+		out << ", \"mean_path_length\": " << (paths ? (double)total(COUNTER_PATH_LENGTH) / paths : 0) << "}" << std::endl << "}" << std::endl;
+		return (bool)out;
+	}
+
+private:
+	std::mutex lock;
+	std::vector<std::unique_ptr<long long[]>> threads;
+	std::chrono::steady_clock::time_point started[NUM_PHASES];
+	double seconds[NUM_PHASES];
+	long long calls[NUM_PHASES];
+
+	Instrumentation()
+	{
+		for(int p = 0; p < NUM_PHASES; p++)
+		{
+			seconds[p] = 0;
+			calls[p] = 0;
+		}
+	}
+
+	long long* addThread()
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		threads.push_back(std::unique_ptr<long long[]>(new long long[NUM_COUNTERS]()));
+		return threads.back().get();
+	}
+};
+
+class instrumentationReport // writes the report when it goes out of scope, however main returns
+{
+public:
+	instrumentationReport(const std::string& path) : path(path) {}
+
+	~instrumentationReport()
+	{
+		Instrumentation::instance().writeJson(path);
+	}
+
+private:
+	std::string path;
+};
+
+#define INSTRUMENT_BEGIN(phase) Instrumentation::instance().begin(phase)
+#define INSTRUMENT_END(phase) Instrumentation::instance().end(phase)
+#define INSTRUMENT_COUNT(counter, n) (Instrumentation::threadCounters()[counter] += (n))
+#define INSTRUMENT_REPORT(path) instrumentationReport instrumentationAtExit(path)
+
+#else
+
+#define INSTRUMENT_BEGIN(phase) ((void)0)
+#define INSTRUMENT_END(phase) ((void)0)
+#define INSTRUMENT_COUNT(counter, n) ((void)0)
+#define INSTRUMENT_REPORT(path) ((void)0)
+
+#endif
+
+#endif
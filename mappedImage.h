@@ -0,0 +1,364 @@
+#ifndef MAPPED_IMAGE_H
+#define MAPPED_IMAGE_H
+
+#include <string>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Uncompressed 8 bit images used in place instead of decoded: binary PGM (P5) and PPM (P6) with a maximum value up to 255, and raw
+// files named "<name>_<width>x<height>.raw" with one (gray) or three (R G B) bytes per pixel. The file is mapped read-only and the
+// pixels are read from the page cache, so opening a large frame neither decodes nor copies it. Other files, 16 bit PNM included,
+// are left to the decoder: open() returns false for them without reading anything.
+//
+// MappedOutput is the other direction: a PGM or PPM file of known size is mapped for writing and the label map or mask is stored
+// into it in place, without an encoded copy in memory.
+
+class MappedImage
+{
+public:
+	int rows, cols;
+	int channels; // 1 (gray) or 3 in the R G B order of the file
+	size_t step; // bytes per row
+	const unsigned char* data; // first pixel, NULL while nothing is mapped
+
+	MappedImage() : rows(0), cols(0), channels(0), step(0), data(NULL), mapping(NULL), length(0), released(0) {}
+
+	MappedImage(MappedImage&& other) : MappedImage()
+	{
+		take(&other);
+	}
+
+	MappedImage& operator=(MappedImage&& other)
+	{
+		if(this != &other)
+		{
+			close();
+			take(&other);
+		}
+		return *this;
+	}
+
+	MappedImage(const MappedImage&) = delete;
+	MappedImage& operator=(const MappedImage&) = delete;
+
+	~MappedImage()
+	{
+		close();
+	}
+
+	static bool mappable(const std::string& path) // by extension: .pgm, .ppm, .pnm or .raw
+	{
+		std::string type = extension(path);
+		return type == ".pgm" || type == ".ppm" || type == ".pnm" || type == ".raw";
+	}
+
+	bool open(const std::string& path)
+	{
+		close();
+		if(!mappable(path))
+		{
+			return false;
+		}
+
+		int file = ::open(path.c_str(), O_RDONLY);
+		if(file < 0)
+		{
+			return false;
+		}
+		struct stat info;
+		if(fstat(file, &info) != 0 || info.st_size == 0)
+		{
+			::close(file);
+			return false;
+		}
+		void* pages = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+		::close(file); // the mapping keeps the file open
+		if(pages == MAP_FAILED)
+		{
+			return false;
+		}
+		mapping = (unsigned char*)pages;
+		length = info.st_size;
+
+		size_t header = 0;
+		bool valid = extension(path) == ".raw" ? rawSize(path) : pnmHeader(&header);
+		if(!valid || cols <= 0 || rows <= 0 || header + (size_t)rows * cols * channels > length)
+		{
+			close();
+			return false;
+		}
+		step = (size_t)cols * channels;
+		data = mapping + header;
+		madvise(pages, length, MADV_SEQUENTIAL); // the segmenters stream through the rows in order
+		return true;
+	}
+
+	void release(int endRow) // the rows above endRow are not used again: their pages leave memory (and are read again if they are)
+	{
+		if(data != NULL)
+		{
+			released = dropPages(mapping, released, (data - mapping) + endRow * step);
+		}
+	}
+
+	void close()
+	{
+		if(mapping != NULL)
+		{
+			munmap(mapping, length);
+		}
+		rows = cols = channels = 0;
+		step = 0;
+		data = NULL;
+		mapping = NULL;
+		length = 0;
+		released = 0;
+	}
+
+	static size_t dropPages(unsigned char* mapping, size_t begin, size_t end) // whole pages of [begin, end); returns where the next call starts
+	{
+		size_t page = (size_t)sysconf(_SC_PAGESIZE);
+		end -= end % page;
+		if(end > begin)
+		{
+			madvise(mapping + begin, end - begin, MADV_DONTNEED);
+			return end;
+		}
+		return begin;
+	}
+
+private:
+	unsigned char* mapping;
+	size_t length;
+	size_t released; // bytes at the start of the mapping given back by release()
+
+	void take(MappedImage* other)
+	{
+		rows = other->rows;
+		cols = other->cols;
+		channels = other->channels;
+		step = other->step;
+		data = other->data;
+		mapping = other->mapping;
+		length = other->length;
+		released = other->released;
+		other->mapping = NULL;
+		other->close();
+	}
+
+	bool pnmHeader(size_t* header) // "P5" or "P6", width, height and maximum value separated by whitespace and # comments, then one whitespace
+	{
+		if(length < 2 || mapping[0] != 'P' || (mapping[1] != '5' && mapping[1] != '6'))
+		{
+			return false;
+		}
+		channels = mapping[1] == '5' ? 1 : 3;
+
+		size_t k = 2;
+		int fields[3];
+		for(int f = 0; f < 3; f++)
+		{
+			while(k < length && (isspace(mapping[k]) || mapping[k] == '#'))
+			{
+				if(mapping[k] == '#')
+				{
+					while(k < length && mapping[k] != '\n')
+					{
+						k++;
+					}
+				}
+				else
+				{
+					k++;
+				}
+			}
+			if(k >= length || !isdigit(mapping[k]))
+			{
+				return false;
+			}
+			fields[f] = 0;
+			while(k < length && isdigit(mapping[k]) && fields[f] < 1 << 24)
+			{
+				fields[f] = fields[f] * 10 + (mapping[k++] - '0');
+			}
+		}
+		if(k >= length || !isspace(mapping[k]) || fields[2] < 1 || fields[2] > 255) // 16 bit samples are decoded
+		{
+			return false;
+		}
+
+		cols = fields[0];
+		rows = fields[1];
+		*header = k + 1;
+		return true;
+	}
+
+	bool rawSize(const std::string& path) // "<width>x<height>" right before ".raw"; the file size gives the channels
+	{
+		size_t end = path.size() - 4, k = end;
+		while(k > 0 && isdigit(path[k - 1]))
+		{
+			k--;
+		}
+		size_t height = k;
+		if(k == end || k < 2 || tolower(path[k - 1]) != 'x')
+		{
+			return false;
+		}
+		size_t width = --k;
+		while(k > 0 && isdigit(path[k - 1]))
+		{
+			k--;
+		}
+		if(k == width)
+		{
+			return false;
+		}
+		cols = atoi(path.c_str() + k);
+		rows = atoi(path.c_str() + height);
+
+		size_t pixels = (size_t)rows * cols;
+		channels = length == pixels ? 1 : length == 3 * pixels ? 3 : 0;
+		return channels != 0;
+	}
+
+	static std::string extension(const std::string& path) // lower case, with the dot
+	{
+		size_t dot = path.rfind('.');
+		std::string type = dot == std::string::npos ? "" : path.substr(dot);
+		for(size_t k = 0; k < type.size(); k++)
+		{
+			type[k] = (char)tolower(type[k]);
+		}
+		return type;
+	}
+};
+
+class MappedOutput
+{
+public:
+	int rows, cols, channels;
+	int bytes; // per sample: 1, or 2 (most significant byte first) for a maximum value above 255
+	size_t step; // bytes per row
+	unsigned char* data; // first pixel, NULL while nothing is mapped
+
+	MappedOutput() : rows(0), cols(0), channels(0), bytes(0), step(0), data(NULL), mapping(NULL), length(0), released(0) {}
+
+	MappedOutput(const MappedOutput&) = delete;
+	MappedOutput& operator=(const MappedOutput&) = delete;
+
+	~MappedOutput()
+	{
+		close();
+	}
+
+	bool create(const std::string& path, int rows, int cols, int channels, int maxValue) // PGM for 1 channel, PPM for 3
+	{
+		close();
+		char header[64];
+		int headerLength = snprintf(header, sizeof(header), "P%d\n%d %d\n%d\n", channels == 1 ? 5 : 6, cols, rows, maxValue);
+
+		this->rows = rows;
+		this->cols = cols;
+		this->channels = channels;
+		bytes = maxValue > 255 ? 2 : 1;
+		step = (size_t)cols * channels * bytes;
+		length = headerLength + step * rows;
+
+		int file = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+		if(file < 0)
+		{
+			return false;
+		}
+		if(posix_fallocate(file, 0, length) != 0) // the blocks are reserved now, so a full disk fails here instead of while writing
+		{
+			::close(file);
+			return false;
+		}
+		void* pages = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, file, 0);
+		::close(file);
+		if(pages == MAP_FAILED)
+		{
+			return false;
+		}
+
+		mapping = (unsigned char*)pages;
+		memcpy(mapping, header, headerLength);
+		data = mapping + headerLength;
+		released = 0;
+		return true;
+	}
+
+	// label map with the largest label maxLabel: "<base>.pgm" with 16 bit gray if the labels fit, otherwise "<base>.ppm" with 24 bit
+	// labels, most significant byte first (in red). Read back by OpenCV, both match the label PNGs of the batch modes.
+	bool createLabels(const std::string& base, int rows, int cols, int maxLabel, std::string* path)
+	{
+		bool gray = maxLabel < 65536;
+		*path = base + (gray ? ".pgm" : ".ppm");
+		return create(*path, rows, cols, gray ? 1 : 3, gray ? 65535 : 255);
+	}
+
+	void storeLabels(int y, const int* labels) // row y of a label map from createLabels()
+	{
+		unsigned char* out = row(y);
+		int width = channels * bytes;
+		for(int j = 0; j < cols; j++)
+		{
+			for(int b = 0; b < width; b++)
+			{
+				out[width * j + b] = (unsigned char)(labels[j] >> (8 * (width - 1 - b)));
+			}
+		}
+	}
+
+	unsigned char* row(int y)
+	{
+		return data + y * step;
+	}
+
+	void release(int endRow) // the rows above endRow are written: their pages leave memory, the kernel writes them back to the file
+	{
+		if(data != NULL)
+		{
+			released = MappedImage::dropPages(mapping, released, (data - mapping) + endRow * step);
+		}
+	}
+
+	bool close() // the pages are written back by the kernel; false if the file was never mapped or could not be unmapped
+	{
+		bool unmapped = mapping != NULL && munmap(mapping, length) == 0;
+		data = NULL;
+		mapping = NULL;
+		length = 0;
+		released = 0;
+		return unmapped;
+	}
+
+	// a whole label map at once, see createLabels()
+	static bool writeLabels(const std::string& base, const int* labels, size_t labelStep, int rows, int cols, int maxLabel, std::string* path)
+	{
+		MappedOutput output;
+		if(!output.createLabels(base, rows, cols, maxLabel, path))
+		{
+			return false;
+		}
+		for(int i = 0; i < rows; i++)
+		{
+			output.storeLabels(i, labels + i * labelStep);
+		}
+		return output.close();
+	}
+
+private:
+	unsigned char* mapping;
+	size_t length;
+	size_t released;
+};
+
+#endif
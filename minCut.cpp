@@ -1,50 +1,148 @@
 #include <iostream>
 #include <queue>
 #include <vector>
-#include <list>
+#include <algorithm>
+#include <chrono>
 #include <limits.h>
-#include <float.h>
 #include <math.h>
 
 #include <opencv2/opencv.hpp>
 
+#include "weightModels.h"
+#include "gridGraph.h"
+#include "augmentingPaths.h"
+#include "bandGraph.h"
+#include "bkMaxflow.h"
+#include "pushRelabel.h"
+#include "tiledMaxflow.h"
+#include "instrumentation.h"
+#include "batchPipeline.h"
+#include "sidecarSeeds.h"
+#include "mappedImage.h"
+#include "segmentationServer.h"
+
 using namespace std;
 using namespace cv;
 
-enum connectivity // directions
-{
-	N = 1, NE, E, SE, S, SW, W, NW
-};
+typedef capacityFor<intensityWeight>::type capType; // exact 16 bit capacities for 8 bit images
+typedef GridGraph<capType> graphType;
+typedef graphType::valueType valueType;
+
+const int SEED_REGION_RADIUS = 8; // the seed regions of the terminal link histograms are squares of this radius around the seeds
 
-struct edge
+struct capacityModel // "w=linear|contrast|colour", "s=<sigma>" and "r=<region weight>"
 {
-	Point pt;
-	float weight;
+	string weights; // edges: 256 - intensity difference, or exp(-d^2 / 2 sigma^2) of the intensity difference or the colour distance
+	double sigma;
+	double regionWeight; // > 0: terminal links of all pixels from the seed region histograms, this many units per log-likelihood ratio
+
+	WeightTable<capType> table() const
+	{
+		return weights == "linear" ? WeightTable<capType>(intensityWeight(), false) : WeightTable<capType>(contrastWeight(sigma), weights == "colour");
+	}
 };
 
 void initialMouseCallback(int, int, int, int, void*);
 void finalMouseCallback(int, int, int, int, void*);
-Point neighbour(Point, int, int, int);
-bool bfs(vector<vector<list<edge>>>, Point, Point, vector<vector<Point>>*, int, int, int maxCapacity = 0);
-float getEdgeWeight(vector<vector<list<edge>>>, Point, Point);
-bool increaseEdgeWeight(vector<vector<list<edge>>>*, Point, Point, float);
-bool decreaseEdgeWeight(vector<vector<list<edge>>>*, Point, Point, float);
-void markCut(vector<vector<list<edge>>>, vector<vector<list<edge>>>, Point, Mat*);
+void refineMouseCallback(int, int, int, int, void*);
+void sourceSide(const graphType&, vector<bool>*);
+void markCut(const graphType&, Mat*);
+void buildGraph(const Mat&, const WeightTable<capType>&, graphType*);
+void coarseToFine(const Mat&, Point, Point, int, int, const WeightTable<capType>&, const vector<valueType>&, Mat*);
+void markBoundary(const Mat&, Mat*);
+int runBatch(int, char**);
+void segmentMask(const Mat&, const Mat&, const vector<Point>&, const vector<Point>&, int, const capacityModel&, const WeightTable<capType>&, graphType*, vector<bool>*, Mat*);
+int runServer(int, char**);
+int runSequence(int, char**, const capacityModel&);
+int capacityOptions(int, int, char**, capacityModel*);
+bool regionTerms(const capacityModel&, const Mat&, const vector<Point>&, const vector<Point>&, vector<valueType>*);
+void linkTerminals(const Mat&, const vector<valueType>&, graphType*);
+bool readGray(const string&, MappedImage*, Mat*);
+bool readColour(const string&, MappedImage*, Mat*, Mat*);
+bool readRequest(const serverRequest&, bool, MappedImage*, Mat*, Mat*);
+bool writeMask(const string&, const Mat&);
+
+enum seedEditType
+{
+	ADD_FOREGROUND, ADD_BACKGROUND, REMOVE_SEED, MOVE_SEED
+};
+
+struct seedEdit
+{
+	seedEditType type;
+	Point pt;
+};
 
 int main(int argc, char** argv)
 {
-	if(argc != 3)
+	if(argc >= 2 && string(argv[1]) == "batch") // headless: "batch <directory or list file> 0/1/2/3/4 [threads]"
+	{
+		return runBatch(argc, argv);
+	}
+	if(argc >= 2 && string(argv[1]) == "serve") // resident: "serve <socket path> [threads]", see segmentationServer.h
+	{
+		return runServer(argc, argv);
+	}
+
+	capacityModel model;
+	argc = capacityOptions(3, argc, argv, &model);
+
+	if(argc < 3 || argc > 5)
 	{
 		cout << "Incorrect number of arguments" << endl;
-		cout << "Usage : ./minCut <path of image> 0/1" << endl;
-		cout << "0 for without capacity scaling, 1 for with capacity scaling" << endl;
+		cout << "Usage : ./minCut <path of image> 0/1/2/3 [threads] or ./minCut <path of image> 4 [levels] [band width] or ./minCut <path of image> 5 [tile size] [tiles in memory]" << endl;
+		cout << "or ./minCut <frame pattern or video> 6 [tolerance], each followed by [w=linear|contrast|colour] [s=<sigma>] [r=<region weight>]" << endl;
+		cout << "0 for without capacity scaling, 1 for with capacity scaling, 2 for Boykov-Kolmogorov, 3 for parallel push-relabel, 4 for coarse-to-fine, 5 for tiled out-of-core, 6 for a frame sequence" << endl;
 		return 0; 
 	}
 
-	Mat input = imread(argv[1], IMREAD_COLOR);
-	Mat gray_input;
+	int solver = atoi(argv[2]);
+	if(model.weights == "colour" && solver > 3)
+	{
+		cout << "Colour weights need solver 0, 1, 2 or 3" << endl;
+		return 0;
+	}
+	if(model.regionWeight > 0 && (solver <= 1 || solver == 5))
+	{
+		cout << "Region terms need solver 2, 3, 4 or 6" << endl;
+		return 0;
+	}
+
+	int cores = max((int)thread::hardware_concurrency(), 1);
+	int threads = solver <= 3 && argc == 4 ? atoi(argv[3]) : cores; // push-relabel threads
+	if(threads < 1)
+	{
+		cout << "Incorrect number of threads: " << argv[3] << endl;
+		return 0;
+	}
+	if(solver == 3 && threads > cores) // over-subscribed: the threads wait for each other at the barriers
+	{
+		cout << "Warning: " << threads << " threads on " << cores << " cores" << endl;
+	}
+
+	if(solver == 6) // frame sequence: every frame is solved from the flow and search trees of the previous one
+	{
+		return runSequence(argc, argv, model);
+	}
 
-	cvtColor(input, gray_input, COLOR_BGR2GRAY); // convert to grayscale (weighted formula)
+	INSTRUMENT_REPORT(string(argv[1]) + ".stats.json"); // with -DINSTRUMENTATION: phase times and solver counters of this run
+
+	INSTRUMENT_BEGIN(PHASE_DECODE);
+	MappedImage mapped; // 8 bit PGM/PPM/raw input is read in place
+	Mat gray_input, image; // the graph is built from image: gray_input, or the colour pixels for colour weights
+
+	if(model.weights == "colour" ? !readColour(argv[1], &mapped, &image, &gray_input) : !readGray(argv[1], &mapped, &gray_input))
+	{
+		cout << "Could not read " << argv[1] << endl;
+		return 0;
+	}
+	if(model.weights != "colour")
+	{
+		image = gray_input;
+	}
+	INSTRUMENT_END(PHASE_DECODE);
+
+	WeightTable<capType> table = model.table(); // every possible edge capacity, computed once
 
 	Mat output(gray_input.rows, gray_input.cols, gray_input.type(), Scalar(0)); // initialize same sized image - all black
 
@@ -65,141 +163,218 @@ int main(int argc, char** argv)
 
 	setMouseCallback("gray", finalMouseCallback, NULL);
 
-	vector<vector<list<edge>>> adjList; // adjacency list
-	vector<vector<Point>> parent; // 2-D parent array for recording path found using BFS 
+	vector<valueType> regions; // terminal link of every intensity, empty without region terms
+	regionTerms(model, gray_input, vector<Point>(1, seeds[0]), vector<Point>(1, seeds[1]), &regions);
 
-	adjList.resize(gray_input.rows);
+	if(solver == 4) // coarse-to-fine: the full graph is only built for the coarsest pyramid level
+	{
+		int levels = argc >= 4 ? atoi(argv[3]) : 4;
+		int band = argc == 5 ? atoi(argv[4]) : 2;
 
-	parent.resize(gray_input.rows);	
+		Mat labels;
+		INSTRUMENT_BEGIN(PHASE_SOLVE); // every level builds and solves its own graph
+		coarseToFine(gray_input, seeds[0], seeds[1], max(levels, 1), max(band, 1), table, regions, &labels);
+		INSTRUMENT_END(PHASE_SOLVE);
 
-	for(int i = 0; i < gray_input.rows; i++)
-	{
-		adjList[i].resize(gray_input.cols);
-		parent[i].resize(gray_input.cols);
+		INSTRUMENT_BEGIN(PHASE_CUT_EXTRACTION);
+		markBoundary(labels, &output);
+		INSTRUMENT_END(PHASE_CUT_EXTRACTION);
+
+		INSTRUMENT_BEGIN(PHASE_RENDER);
+		namedWindow("final", WINDOW_NORMAL);
+		imshow("final", output);
+		INSTRUMENT_END(PHASE_RENDER);
+		waitKey(0);
 
-		fill(parent[i].begin(), parent[i].end(), Point(-1, -1)); // initialize parent array
+		return 0;
+	}
 
-		for(int j = 0; j < gray_input.cols; j++)
+	if(solver == 5) // tiled: only a fixed number of tiles of the graph are in memory, the mask is written to a file
+	{
+		int tileSize = argc >= 4 ? atoi(argv[3]) : 512;
+		int residentTiles = argc == 5 ? atoi(argv[4]) : 16;
+
+		INSTRUMENT_BEGIN(PHASE_GRAPH_BUILD);
+		TiledMaxflow<capType> tiled(gray_input.rows, gray_input.cols, tileSize, residentTiles);
+		bool solved = tiled.build(table, gray_input.data, gray_input.step);
+		INSTRUMENT_END(PHASE_GRAPH_BUILD);
+
+		INSTRUMENT_BEGIN(PHASE_SOLVE);
+		solved = solved && tiled.setSeed(seeds[0].x, seeds[0].y, 1) && tiled.setSeed(seeds[1].x, seeds[1].y, -1) && tiled.maxflow();
+		INSTRUMENT_END(PHASE_SOLVE);
+		if(!solved)
 		{
-			int curIntensity = gray_input.at<uchar>(i, j);
+			cout << "Could not spill tiles to a temporary file" << endl;
+			return 1;
+		}
 
-			for(int k = 1; k <= 8; k+=2) // k++ implies 8-connectivity, k+=2 implies 4 connectivity
-			{
-				Point nbh = neighbour(Point(j, i), k, gray_input.cols, gray_input.rows); // neighbour
-				if(nbh.x != -1 && nbh.y != -1)
-				{
-					int adjIntensity = gray_input.at<uchar>(nbh);
-					edge temp;
-					temp.pt = nbh;
-					temp.weight = 256-abs(curIntensity - adjIntensity); // weight of edge; higher weight implies less difference in intensities
-					adjList[i][j].push_back(temp);
-				}
-			}
+		string maskPath = string(argv[1]) + ".mask.pgm";
+		INSTRUMENT_BEGIN(PHASE_CUT_EXTRACTION);
+		bool written = tiled.writeMask(maskPath.c_str());
+		INSTRUMENT_END(PHASE_CUT_EXTRACTION);
+		if(!written)
+		{
+			cout << "Could not write " << maskPath << endl;
+			return 0;
 		}
+		cout << "Mask written to " << maskPath << " (" << tiled.sweeps << " sweeps, " << tiled.loads << " tile loads)" << endl;
+
+		return 0;
 	}
 
-	vector<vector<list<edge>>> originalAdjList(adjList); // copy adjacency list
+	INSTRUMENT_BEGIN(PHASE_GRAPH_BUILD);
+	graphType graph(gray_input.rows, gray_input.cols); // residual network; neighbours are implicit from the pixel index
 
-	if(atoi(argv[2]) == 0) // normal approach without capacity scaling
+	buildGraph(image, table, &graph);
+	if(!regions.empty())
 	{
-		while(bfs(adjList, seeds[0], seeds[1], &parent, gray_input.rows, gray_input.cols)) // while there is a path from source to target (bfs funciton populates "parent")
+		linkTerminals(gray_input, regions, &graph);
+	}
+	INSTRUMENT_END(PHASE_GRAPH_BUILD);
+
+	int s = graph.index(seeds[0].x, seeds[0].y);
+	int t = graph.index(seeds[1].x, seeds[1].y);
+
+	graph.terminal[s] = graphType::traits::infinity(); // seeds are linked to the terminals with infinite capacity
+	graph.terminal[t] = -graphType::traits::infinity();
+
+	BKMaxflow<capType>* bk = NULL; // kept for incremental re-solves
+
+	INSTRUMENT_BEGIN(PHASE_SOLVE);
+	if(solver == 0) // normal approach without capacity scaling
+	{
+		AugmentingPaths<capType> paths(&graph, s, t);
+		paths.maxflow();
+	}
+
+	else if(solver == 1) // capacity scaling approach
+	{
+		AugmentingPaths<capType> paths(&graph, s, t);
+		paths.scalingMaxflow(table.maxWeight);
+	}
+	else if(solver == 2) // Boykov-Kolmogorov search trees
+	{
+		bk = new BKMaxflow<capType>(&graph);
+		bk->maxflow();
+	}
+	else if(solver == 3) // parallel push-relabel
+	{
+		ParallelPushRelabel<capType> pushRelabel(&graph, threads);
+		pushRelabel.maxflow();
+	}
+	else
+	{
+		cout << "Incorrect argument for solver" << endl;
+		return 0;
+	}
+	INSTRUMENT_END(PHASE_SOLVE);
+
+	INSTRUMENT_BEGIN(PHASE_CUT_EXTRACTION);
+	markCut(graph, &output); // mark the cut in the output image
+	INSTRUMENT_END(PHASE_CUT_EXTRACTION);
+
+	INSTRUMENT_BEGIN(PHASE_RENDER);
+	namedWindow("final", WINDOW_NORMAL);
+	imshow("final", output);
+	INSTRUMENT_END(PHASE_RENDER);
+
+	if(bk == NULL)
+	{
+		waitKey(0);
+
+		return 0;
+	}
+
+	// refine the seeds; every change is re-solved from the current flow and search trees instead of from scratch
+
+	vector<Point> foreground(1, seeds[0]), background(1, seeds[1]);
+	vector<seedEdit> edits;
+
+	cout << "Left/right click adds a foreground/background seed, ctrl+click removes the nearest seed, shift+click moves it there; press Esc to exit" << endl;
+
+	setMouseCallback("gray", refineMouseCallback, &edits);
+
+	while(waitKey(30) != 27)
+	{
+		if(edits.empty())
 		{
-			count++;
-			float flow = FLT_MAX;
-			Point foo = seeds[1];
-			while(foo != seeds[0]) // calculating minimum of all weights in the path; equivalent to finding minimum/bottleneck capacity in the chosen path
-			{
-				Point fooParent = parent[foo.y][foo.x];
-				float edgeWeight = getEdgeWeight(adjList, fooParent, foo);
-				if(edgeWeight < 0)
-				{
-					cerr << "Error!";
-					return 0;
-				}
-				if(flow > edgeWeight)
-				{
-					flow = edgeWeight;
-				}
-				foo = fooParent;
-			}
+			continue;
+		}
 
-			foo = seeds[1];
-			while(foo != seeds[0]) // increase and decrease edge weights by amount "flow"- minimum weight of all edges, as found above
+		for(size_t e = 0; e < edits.size(); e++)
+		{
+			Point pt = edits[e].pt;
+			if(!graph.contains(pt.x, pt.y))
 			{
-				Point fooParent = parent[foo.y][foo.x];
-				increaseEdgeWeight(&adjList, foo, fooParent, flow);
-				decreaseEdgeWeight(&adjList, fooParent, foo, flow);
-
-				foo = fooParent;
+				continue;
 			}
 
-			for(int i = 0; i < gray_input.rows; i++) // reset parent array
+			if(edits[e].type == ADD_FOREGROUND || edits[e].type == ADD_BACKGROUND)
 			{
-				fill(parent[i].begin(), parent[i].end(), Point(-1, -1));
+				bk->setSeed(graph.index(pt.x, pt.y), edits[e].type == ADD_FOREGROUND ? 1 : -1);
+				(edits[e].type == ADD_FOREGROUND ? foreground : background).push_back(pt);
+				continue;
 			}
-		}
-	}
 
-	else if(atoi(argv[2]) == 1) // capacity scaling approach
-	{
-		int maxCapacity = 256;
+			// nearest seed to the click
 
-		while(maxCapacity >= 1)
-		{
-			while(bfs(adjList, seeds[0], seeds[1], &parent, gray_input.rows, gray_input.cols, maxCapacity)) // while there is a path from source to target (bfs funciton populates "parent")
+			vector<Point>* list = NULL;
+			size_t nearest = 0;
+			int nearestDistance = INT_MAX;
+			for(int k = 0; k < 2; k++)
 			{
-				count++;
-				float flow = FLT_MAX;
-				Point foo = seeds[1];
-				while(foo != seeds[0]) // calculating minimum of all weights in the path; equivalent to finding minimum/bottleneck capacity in the chosen path
+				vector<Point>* candidates = k == 0 ? &foreground : &background;
+				for(size_t i = 0; i < candidates->size(); i++)
 				{
-					//cout << "(" << foo.y << "," << foo.x << ") ";
-					Point fooParent = parent[foo.y][foo.x];
-					float edgeWeight = getEdgeWeight(adjList, fooParent, foo);
-					if(edgeWeight < 0)
-					{
-						cerr << "Error!";
-						return 0;
-					}
-					if(flow > edgeWeight)
+					Point diff = (*candidates)[i] - pt;
+					if(diff.dot(diff) < nearestDistance)
 					{
-						flow = edgeWeight;
+						nearestDistance = diff.dot(diff);
+						list = candidates;
+						nearest = i;
 					}
-					foo = fooParent;
 				}
-				//cout << count << endl;
-
-				foo = seeds[1];
-				while(foo != seeds[0]) // increase and decrease edge weights by amount "flow"- minimum weight of all edges, as found above
-				{
-					Point fooParent = parent[foo.y][foo.x];
-					increaseEdgeWeight(&adjList, foo, fooParent, flow);
-					decreaseEdgeWeight(&adjList, fooParent, foo, flow);
+			}
+			if(list == NULL)
+			{
+				continue;
+			}
 
-					foo = fooParent;
-				}
+			Point old = (*list)[nearest];
+			list->erase(list->begin() + nearest);
 
-				for(int i = 0; i < gray_input.rows; i++) // reset parent array
-				{
-					fill(parent[i].begin(), parent[i].end(), Point(-1, -1));
-				}
+			int label = find(foreground.begin(), foreground.end(), old) != foreground.end() ? 1 : find(background.begin(), background.end(), old) != background.end() ? -1 : 0; // clicked twice
+			if(label == 0 && !regions.empty()) // back to the link of its intensity
+			{
+				bk->setTerminal(graph.index(old.x, old.y), regions[gray_input.at<uchar>(old)]);
+			}
+			else
+			{
+				bk->setSeed(graph.index(old.x, old.y), label);
+			}
+			if(edits[e].type == MOVE_SEED)
+			{
+				bk->setSeed(graph.index(pt.x, pt.y), list == &foreground ? 1 : -1);
+				list->push_back(pt);
 			}
-
-			maxCapacity /= 2;
 		}
-	}
-	else
-	{
-		cout << "Incorrect argument for capacity scaling" << endl;
-		return 0;
-	}
+		edits.clear();
 
-	markCut(originalAdjList, adjList, seeds[0], &output); // mark the cut in the output image
+		INSTRUMENT_BEGIN(PHASE_SOLVE);
+		bk->maxflow();
+		INSTRUMENT_END(PHASE_SOLVE);
 
-	namedWindow("final", WINDOW_NORMAL);
-	imshow("final", output);
+		INSTRUMENT_BEGIN(PHASE_CUT_EXTRACTION);
+		output = Scalar(0);
+		markCut(graph, &output);
+		INSTRUMENT_END(PHASE_CUT_EXTRACTION);
 
-	waitKey(0);
+		INSTRUMENT_BEGIN(PHASE_RENDER);
+		imshow("final", output);
+		INSTRUMENT_END(PHASE_RENDER);
+	}
+
+	delete bk;
 
 	return 0;
 }
@@ -218,221 +393,905 @@ void finalMouseCallback(int event, int x, int y, int flags, void* userdata)
 	return;
 }
 
-Point neighbour(Point input, int direction, int cols, int rows) // calculates neighbour based on direction input
+void refineMouseCallback(int event, int x, int y, int flags, void* v) // record seed changes
 {
-	switch(direction)
+	seedEdit edit;
+	edit.pt = Point(x, y);
+
+	if(event == EVENT_LBUTTONDOWN && (flags & EVENT_FLAG_CTRLKEY))
 	{
-		case N:
+		edit.type = REMOVE_SEED;
+	}
+	else if(event == EVENT_LBUTTONDOWN && (flags & EVENT_FLAG_SHIFTKEY))
+	{
+		edit.type = MOVE_SEED;
+	}
+	else if(event == EVENT_LBUTTONDOWN || event == EVENT_RBUTTONDOWN)
+	{
+		edit.type = event == EVENT_LBUTTONDOWN ? ADD_FOREGROUND : ADD_BACKGROUND;
+	}
+	else
+	{
+		return;
+	}
+
+	cout << x << " " << y << endl;
+	((vector<seedEdit>*)v)->push_back(edit);
+}
+
+void sourceSide(const graphType& graph, vector<bool>* side) // pixels the source reaches in the residual network after a max-flow
+{
+	// initial BFS over arcs with positive residual capacity, from every pixel the source can still reach directly
+
+	vector<bool>& visited = *side;
+	visited.assign(graph.size(), false);
+
+	queue<int> q;
+	for(int p = 0; p < graph.size(); p++)
+	{
+		if(graphType::traits::positive(graph.terminal[p]))
 		{
-			input.y--;
-			break;
+			q.push(p);
+			visited[p] = true;
 		}
+	}
+
+	while(!q.empty())
+	{
+		int temp = q.front();
+		q.pop();
 
-		case NE:
+		for(int d = 0; d < GridLayout::NUM_ARCS; d++)
 		{
-			input.x++;
-			input.y--;
-			break;
+			if(graph.unsaturated(temp, d) && !visited[graph.neighbour(temp, d)])
+			{
+				q.push(graph.neighbour(temp, d));
+				visited[graph.neighbour(temp, d)] = true;
+			}
 		}
+	}
+}
+
+void markCut(const graphType& graph, Mat* output)
+{
+	vector<bool> visited;
+	sourceSide(graph, &visited);
 
-		case E:
+	for(int p = 0; p < graph.size(); p++)
+	{
+		if(visited[p]) // nodes reachable from source vertex
 		{
-			input.x++;
-			break;
+			for(int d = 0; d < GridLayout::NUM_ARCS; d++)
+			{
+				if(graph.hasArc(p, d) && !visited[graph.neighbour(p, d)]) // if it has an edge to a non-reachable vertex in the original graph, that edge is part of the min cut
+				{
+					int adj = graph.neighbour(p, d);
+					output->at<uchar>(p / graph.cols, p % graph.cols) = 255;
+					output->at<uchar>(adj / graph.cols, adj % graph.cols) = 255;
+				}
+			}
 		}
+	}
+}
+
+void buildGraph(const Mat& image, const WeightTable<capType>& table, graphType* graph) // gray, or colour for a colour table
+{
+	graph->build(table, image.data, image.step, image.channels());
+}
+
+void coarseToFine(const Mat& gray, Point foreground, Point background, int levels, int band, const WeightTable<capType>& table, const vector<valueType>& regions, Mat* labels)
+{
+	// labels: 1 for the source side of the cut, 0 for the sink side; regions: terminal links by intensity, or empty
+
+	vector<Mat> pyramid(1, gray);
+	for(int l = 1; l < levels; l++)
+	{
+		Mat down;
+		pyrDown(pyramid.back(), down);
+		pyramid.push_back(down);
+	}
+
+	// full solve on the coarsest level
+
+	const Mat& coarsest = pyramid.back();
+	graphType graph(coarsest.rows, coarsest.cols);
+	buildGraph(coarsest, table, &graph);
+	if(!regions.empty())
+	{
+		linkTerminals(coarsest, regions, &graph);
+	}
+
+	graph.terminal[graph.index(foreground.x >> (levels - 1), foreground.y >> (levels - 1))] = graphType::traits::infinity();
+	graph.terminal[graph.index(background.x >> (levels - 1), background.y >> (levels - 1))] = -graphType::traits::infinity();
+
+	BKMaxflow<capType> bk(&graph);
+	bk.maxflow();
 
-		case SE:
+	*labels = Mat(coarsest.rows, coarsest.cols, CV_8UC1);
+	for(int p = 0; p < graph.size(); p++)
+	{
+		labels->at<uchar>(p / graph.cols, p % graph.cols) = bk.segment(p) == BKMaxflow<capType>::SOURCE;
+	}
+
+	// every finer level: upsample the labels and re-solve a band around their boundary, the rest stays fixed
+
+	for(int l = levels - 2; l >= 0; l--)
+	{
+		const Mat& image = pyramid[l];
+
+		Mat upsampled(image.rows, image.cols, CV_8UC1);
+		for(int i = 0; i < image.rows; i++)
 		{
-			input.x++;
-			input.y++;
-			break;
+			for(int j = 0; j < image.cols; j++)
+			{
+				upsampled.at<uchar>(i, j) = labels->at<uchar>(i / 2, j / 2);
+			}
 		}
+		*labels = upsampled;
 
-		case S:
+		Mat boundary(image.rows, image.cols, CV_8UC1, Scalar(0)), inBand;
+		markBoundary(*labels, &boundary);
+		dilate(boundary, inBand, getStructuringElement(MORPH_RECT, Size(2 * band + 1, 2 * band + 1)));
+
+		BandGraph<capType> bandGraph(image.cols);
+		vector<int> columns;
+		for(int i = 0; i < image.rows; i++)
 		{
-			input.y++;
-			break;
+			columns.clear();
+			for(int j = 0; j < image.cols; j++)
+			{
+				if(inBand.at<uchar>(i, j))
+				{
+					columns.push_back(j);
+				}
+			}
+			bandGraph.addRow(columns);
 		}
 
-		case SW:
+		for(int i = 0; i < image.rows; i++)
 		{
-			input.x--;
-			input.y++;
-			break;
+			for(int v = bandGraph.rowStart[i]; v < bandGraph.rowStart[i + 1]; v++)
+			{
+				int j = bandGraph.column[v];
+				int curIntensity = image.at<uchar>(i, j);
+				if(!regions.empty())
+				{
+					bandGraph.terminal[v] += regions[curIntensity];
+				}
+
+				for(int d = 0; d < GridLayout::NUM_ARCS; d++)
+				{
+					Point nbh(j + GridLayout::dx(d), i + GridLayout::dy(d));
+					if(nbh.x < 0 || nbh.x >= image.cols || nbh.y < 0 || nbh.y >= image.rows)
+					{
+						continue;
+					}
+
+					int weight = table(curIntensity, image.at<uchar>(nbh));
+					if(bandGraph.find(nbh.x, nbh.y) != -1)
+					{
+						bandGraph.capacity[d][v] = weight;
+					}
+					else // the neighbour keeps its label: the edge becomes a link to its terminal
+					{
+						bandGraph.terminal[v] += labels->at<uchar>(nbh) ? weight : -weight;
+					}
+				}
+			}
 		}
 
-		case W:
+		int s = bandGraph.find(foreground.x >> l, foreground.y >> l);
+		int t = bandGraph.find(background.x >> l, background.y >> l);
+		if(s != -1)
 		{
-			input.x--;
-			break;
+			bandGraph.terminal[s] = graphType::traits::infinity();
 		}
+		if(t != -1)
+		{
+			bandGraph.terminal[t] = -graphType::traits::infinity();
+		}
+
+		BKMaxflow<capType, BandGraph<capType> > bandBk(&bandGraph);
+		bandBk.maxflow();
 
-		case NW:
+		for(int i = 0; i < image.rows; i++)
 		{
-			input.x--;
-			input.y--;
-			break;
+			for(int v = bandGraph.rowStart[i]; v < bandGraph.rowStart[i + 1]; v++)
+			{
+				labels->at<uchar>(i, bandGraph.column[v]) = bandBk.segment(v) == BKMaxflow<capType, BandGraph<capType> >::SOURCE;
+			}
 		}
 	}
-	if(input.x < 0 || input.x >= cols || input.y < 0 || input.y >= rows)
+}
+
+void markBoundary(const Mat& labels, Mat* output) // both pixels of every edge between different labels, as markCut does for a cut
+{
+	for(int i = 0; i < labels.rows; i++)
 	{
-		return Point(-1, -1);
+		for(int j = 0; j < labels.cols; j++)
+		{
+			if(j + 1 < labels.cols && labels.at<uchar>(i, j) != labels.at<uchar>(i, j + 1))
+			{
+				output->at<uchar>(i, j) = 255;
+				output->at<uchar>(i, j + 1) = 255;
+			}
+			if(i + 1 < labels.rows && labels.at<uchar>(i, j) != labels.at<uchar>(i + 1, j))
+			{
+				output->at<uchar>(i, j) = 255;
+				output->at<uchar>(i + 1, j) = 255;
+			}
+		}
 	}
-	return input;
 }
 
-bool bfs(vector<vector<list<edge>>> adjList, Point s, Point t, vector<vector<Point>>* parent, int rows, int cols, int maxCapacity)
+// batch mode: every image is solved on one thread, the images in parallel. Seeds come from "<image path>.seeds.csv" or ".seeds.json";
+// solvers 2 and 3 link every seed to its terminal, solvers 0, 1 and 4 use the first foreground and the first background seed.
+// The mask (255 on the source side of the cut) is written to "<image path>.mask.png", or for PGM, PPM and raw input into a mapped
+// "<image path>.mask.pgm".
+
+struct minCutJob
 {
-	bool** visited = new bool*[rows]; // 2-D "visited" array
-	for(int i = 0; i < rows; i++)
+	string path;
+	MappedImage mapped; // set for PGM, PPM and raw input; gray may be a view of it
+	Mat gray, image; // image: the colour pixels for colour weights, otherwise gray
+	vector<Point> foreground, background;
+	Mat mask;
+};
+
+int runBatch(int argc, char** argv)
+{
+	capacityModel model;
+	argc = capacityOptions(4, argc, argv, &model);
+
+	if(argc < 4 || atoi(argv[3]) < 0 || atoi(argv[3]) > 4)
+	{
+		cout << "Usage : ./minCut batch <directory or list file> 0/1/2/3/4 [threads] [w=linear|contrast|colour] [s=<sigma>] [r=<region weight>]" << endl;
+		return 0;
+	}
+
+	string input(argv[2]);
+	int solver = atoi(argv[3]);
+	int threads = argc >= 5 ? atoi(argv[4]) : (int)thread::hardware_concurrency();
+	if((model.weights == "colour" && solver > 3) || (model.regionWeight > 0 && solver <= 1))
 	{
-		visited[i] = new bool[cols];
-		memset(visited[i], false, sizeof(bool) * cols);
+		cout << "Colour weights need solver 0, 1, 2 or 3 and region terms solver 2, 3 or 4" << endl;
+		return 0;
 	}
+	WeightTable<capType> table = model.table();
 
-	queue<Point> q;
-	q.push(s);
-	visited[s.y][s.x] = true;
-	(*parent)[s.y][s.x] = Point(-1, -1);
+	INSTRUMENT_REPORT(input + ".stats.json");
 
-	while(!q.empty() && visited[t.y][t.x] != true)
+	vector<string> paths;
+	if(!BatchPipeline::listImages(input, &paths))
 	{
-		Point temp = q.front();
-		q.pop();
+		cout << "Could not read " << input << endl;
+		return 1;
+	}
+
+	int failures = BatchPipeline::run<minCutJob>(paths, threads, [&](const string& path, minCutJob* job)
+	{
+		job->path = path;
+		if(model.weights == "colour" ? !readColour(path, &job->mapped, &job->image, &job->gray) : !readGray(path, &job->mapped, &job->gray))
+		{
+			cout << "Could not read " << path << endl;
+			return false;
+		}
+		if(model.weights != "colour")
+		{
+			job->image = job->gray;
+		}
 
-		auto it = adjList[temp.y][temp.x].begin();
-		while(it != adjList[temp.y][temp.x].end()) // iterate through neighbours of the node
+		vector<seedPoint> seeds;
+		SidecarSeeds::read(path, &seeds);
+		for(size_t k = 0; k < seeds.size(); k++)
 		{
-			if((*it).weight >= maxCapacity && !visited[(*it).pt.y][(*it).pt.x]) // if positive weight and neighbour has not been visited, enqueue, mark visited as true and mark parent
+			if(seeds[k].x >= 0 && seeds[k].x < job->gray.cols && seeds[k].y >= 0 && seeds[k].y < job->gray.rows && seeds[k].label != 0)
 			{
-				q.push((*it).pt);
-				visited[(*it).pt.y][(*it).pt.x] = true;
-				(*parent)[(*it).pt.y][(*it).pt.x] = temp;
+				(seeds[k].label > 0 ? job->foreground : job->background).push_back(Point(seeds[k].x, seeds[k].y));
 			}
-			it++;
 		}
+		if(job->foreground.empty() || job->background.empty())
+		{
+			cout << "No foreground and background seed for " << path << endl;
+			return false;
+		}
+		return true;
+	}, [&](minCutJob* job)
+	{
+		graphType graph(0, 0);
+		vector<bool> side;
+		segmentMask(job->image, job->gray, job->foreground, job->background, solver, model, table, &graph, &side, &job->mask);
+	}, [&](minCutJob* job)
+	{
+		if(job->mapped.data != NULL) // PNM in, PNM out: the mask is stored straight into the mapped file
+		{
+			string path = job->path + ".mask.pgm";
+			if(!writeMask(path, job->mask))
+			{
+				cout << "Could not write " << path << endl;
+				return false;
+			}
+			return true;
+		}
+
+		string path = job->path + ".mask.png";
+		if(!imwrite(path, job->mask))
+		{
+			cout << "Could not write " << path << endl;
+			return false;
+		}
+		return true;
+	});
+
+	cout << paths.size() - failures << " of " << paths.size() << " images segmented" << endl;
+	return failures == 0 ? 0 : 1;
+}
+
+// the mask (255 on the source side of the cut) of image: gray, or the colour pixels for a colour table; region terms come from gray.
+// Solvers 2 and 3 link every seed to its terminal, solvers 0, 1 and 4 use the first foreground and the first background seed.
+// graph, side and mask are reused: they only allocate when the image is larger than every earlier one.
+void segmentMask(const Mat& image, const Mat& gray, const vector<Point>& foreground, const vector<Point>& background, int solver, const capacityModel& model,
+	const WeightTable<capType>& table, graphType* graph, vector<bool>* side, Mat* mask)
+{
+	vector<valueType> regions;
+	regionTerms(model, gray, foreground, background, &regions);
+
+	if(solver == 4)
+	{
+		Mat labels;
+		coarseToFine(gray, foreground[0], background[0], 4, 2, table, regions, &labels);
+		threshold(labels, *mask, 0, 255, THRESH_BINARY);
+		return;
 	}
 
-	bool returnValue = visited[t.y][t.x];
+	graph->reset(gray.rows, gray.cols);
+	buildGraph(image, table, graph);
+	if(!regions.empty())
+	{
+		linkTerminals(gray, regions, graph);
+	}
 
-	for(int i = 0; i < rows; i++)
+	size_t seedCount = solver <= 1 ? 1 : max(foreground.size(), background.size());
+	for(size_t k = 0; k < seedCount; k++)
 	{
-		delete [] visited[i];
+		if(k < foreground.size())
+		{
+			graph->terminal[graph->index(foreground[k].x, foreground[k].y)] = graphType::traits::infinity();
+		}
+		if(k < background.size())
+		{
+			graph->terminal[graph->index(background[k].x, background[k].y)] = -graphType::traits::infinity();
+		}
 	}
 
-	delete [] visited;
+	if(solver <= 1)
+	{
+		AugmentingPaths<capType> paths(graph, graph->index(foreground[0].x, foreground[0].y), graph->index(background[0].x, background[0].y));
+		if(solver == 0)
+		{
+			paths.maxflow();
+		}
+		else
+		{
+			paths.scalingMaxflow(table.maxWeight);
+		}
+	}
+	else if(solver == 2)
+	{
+		BKMaxflow<capType> bk(graph);
+		bk.maxflow();
+	}
+	else
+	{
+		ParallelPushRelabel<capType> pushRelabel(graph, 1);
+		pushRelabel.maxflow();
+	}
 
-	return returnValue;
+	sourceSide(*graph, side);
+	mask->create(gray.rows, gray.cols, CV_8UC1);
+	for(int i = 0; i < gray.rows; i++)
+	{
+		uchar* row = mask->ptr<uchar>(i);
+		for(int j = 0; j < gray.cols; j++)
+		{
+			row[j] = (*side)[i * gray.cols + j] ? 255 : 0;
+		}
+	}
 }
 
-float getEdgeWeight(vector<vector<list<edge>>> adjList, Point u, Point v)
+// server mode: "serve <socket path> [threads] [w=... s=... r=...]" answers requests with "solver=0..4" (default 2), optional
+// "w=", "s=" and "r=" instead of the server's capacity model, and at least one foreground and one background seed with the mask.
+
+struct minCutWorker // everything a request needs, kept from one request to the next
+{
+	MappedImage mapped;
+	Mat gray, image;
+	vector<Point> foreground, background;
+	graphType graph;
+	vector<bool> side;
+	Mat mask;
+
+	minCutWorker() : graph(0, 0) {}
+};
+
+int runServer(int argc, char** argv)
 {
-	auto it = adjList[u.y][u.x].begin();
-	while(it != adjList[u.y][u.x].end())
+	capacityModel defaults;
+	argc = capacityOptions(3, argc, argv, &defaults);
+	if(argc < 3)
+	{
+		cout << "Usage : ./minCut serve <socket path> [threads] [w=linear|contrast|colour] [s=<sigma>] [r=<region weight>]" << endl;
+		return 0;
+	}
+	int threads = argc >= 4 ? atoi(argv[3]) : (int)thread::hardware_concurrency();
+
+	auto requestModel = [&](const serverRequest& request, capacityModel* model, int* solver, string* error)
 	{
-		if((*it).pt == v)
+		model->weights = request.value("w", defaults.weights);
+		model->sigma = atof(request.value("s", to_string(defaults.sigma)).c_str());
+		model->regionWeight = atof(request.value("r", to_string(defaults.regionWeight)).c_str());
+		*solver = atoi(request.value("solver", "2").c_str());
+
+		if(model->weights != "linear" && model->weights != "contrast" && model->weights != "colour")
+		{
+			*error = "expected w=linear|contrast|colour";
+		}
+		else if(model->sigma <= 0 || model->regionWeight < 0 || *solver < 0 || *solver > 4)
 		{
-			return (*it).weight;
+			*error = "expected s=<sigma> > 0, r=<region weight> >= 0 and solver=0..4";
 		}
-		it++;
+		else if((model->weights == "colour" && *solver > 3) || (model->regionWeight > 0 && *solver <= 1))
+		{
+			*error = "colour weights need solver 0, 1, 2 or 3 and region terms solver 2, 3 or 4";
+		}
+		return error->empty();
+	};
+
+	cout << "Listening on " << argv[2] << endl;
+	bool served = SegmentationServer::run<minCutWorker>(argv[2], threads, [&](const serverRequest& request, minCutWorker* worker, string* error)
+	{
+		capacityModel model;
+		int solver;
+		if(!requestModel(request, &model, &solver, error))
+		{
+			return false;
+		}
+		if(!readRequest(request, model.weights == "colour", &worker->mapped, &worker->image, &worker->gray))
+		{
+			*error = "could not read the image";
+			return false;
+		}
+
+		worker->foreground.clear();
+		worker->background.clear();
+		for(size_t k = 0; k < request.seeds.size(); k++)
+		{
+			const seedPoint& seed = request.seeds[k];
+			if(seed.x >= 0 && seed.x < worker->gray.cols && seed.y >= 0 && seed.y < worker->gray.rows && seed.label != 0)
+			{
+				(seed.label > 0 ? worker->foreground : worker->background).push_back(Point(seed.x, seed.y));
+			}
+		}
+		if(worker->foreground.empty() || worker->background.empty())
+		{
+			*error = "expected a foreground and a background seed=<x>,<y>,<label> in the image";
+			return false;
+		}
+		return true;
+	}, [&](const serverRequest& request, minCutWorker* worker, serverResponse* response)
+	{
+		capacityModel model;
+		int solver;
+		string unused;
+		requestModel(request, &model, &solver, &unused);
+
+		segmentMask(worker->image, worker->gray, worker->foreground, worker->background, solver, model, model.table(), &worker->graph, &worker->side, &worker->mask);
+
+		const Mat& mask = worker->mask;
+		response->type = "mask";
+		response->rows = mask.rows;
+		response->cols = mask.cols;
+		response->count = 2;
+		response->data.resize((size_t)mask.rows * mask.cols);
+		for(int i = 0; i < mask.rows; i++)
+		{
+			memcpy(&response->data[(size_t)i * mask.cols], mask.ptr<uchar>(i), mask.cols);
+		}
+	});
+
+	if(!served)
+	{
+		cout << "Could not listen on " << argv[2] << endl;
+		return 1;
 	}
-	return -1.0;
+	return 0;
 }
 
-bool increaseEdgeWeight(vector<vector<list<edge>>>* adjList, Point u, Point v, float increase)
+// sequence mode: numbered frames ("frames/%04d.png", starting at 0 or 1) or a video file. The seeds of the first frame (from
+// "<frames>.seeds.csv" / ".seeds.json", or clicked) stay in place, and every later frame only updates the capacities of the edges
+// at pixels whose intensity changed by more than the tolerance; Boykov-Kolmogorov then repairs the flow and trees of the previous
+// frame instead of solving from scratch. The mask of frame k is written to "<frame path>.mask.png" ("<video>.<k>.mask.png").
+
+class frameSource
 {
-	auto it = (*adjList)[u.y][u.x].begin();
-	while(it != (*adjList)[u.y][u.x].end())
+public:
+	frameSource(const string& path) : path(path), index(0)
 	{
-		if((*it).pt == v)
+		if(path.find('%') == string::npos)
 		{
-			(*it).weight += increase;
-			return true;
+			video = VideoCapture(path);
 		}
-		it++;
 	}
-}
 
-bool decreaseEdgeWeight(vector<vector<list<edge>>>* adjList, Point u, Point v, float decrease)
-{
-	auto it = (*adjList)[u.y][u.x].begin();
-	while(it != (*adjList)[u.y][u.x].end())
+	bool read(Mat* gray, string* name) // PGM, PPM and raw frames are mapped, and gray is a view of the mapping until the next read
 	{
-		if((*it).pt == v)
+		if(path.find('%') == string::npos)
 		{
-			(*it).weight -= decrease;
-			if((*it).weight < 0)
+			*name = path + "." + to_string(index++);
+			Mat frame;
+			if(!video.read(frame) || frame.empty())
 			{
-				cerr << "Negative error!" << endl;
+				return false;
 			}
-			if((*it).weight < 0.00001) // assume weight is 0 and erase edge
+			cvtColor(frame, *gray, COLOR_BGR2GRAY);
+			return true;
+		}
+
+		for(int attempt = index == 0 ? 2 : 1; attempt > 0; attempt--) // numbering may start at 0 or 1
+		{
+			char buffer[4096];
+			snprintf(buffer, sizeof(buffer), path.c_str(), index++);
+			*name = buffer;
+			if(readGray(*name, &mapped, gray))
 			{
-				(*adjList)[u.y][u.x].erase(it);
+				return true;
 			}
-			return true;
 		}
-		it++;
+		return false;
 	}
-	cerr << "Decrease error!" << endl;
-	return false;
-}
 
-void markCut(vector<vector<list<edge>>> originalAdjList, vector<vector<list<edge>>> adjList, Point s, Mat* output)
+	bool isMapped() const
+	{
+		return mapped.data != NULL;
+	}
+
+private:
+	string path;
+	int index;
+	VideoCapture video;
+	MappedImage mapped;
+};
+
+int runSequence(int argc, char** argv, const capacityModel& model)
 {
-	// initial BFS
+	int tolerance = argc >= 4 ? max(atoi(argv[3]), 0) : 0; // intensity changes up to this are ignored
+
+	INSTRUMENT_REPORT(string(argv[1]) + ".stats.json");
 
-	bool** visited = new bool*[output->rows];
-	for(int i = 0; i < output->rows; i++)
+	frameSource frames(argv[1]);
+	Mat gray;
+	string name;
+	if(!frames.read(&gray, &name))
 	{
-		visited[i] = new bool[output->cols];
-		memset(visited[i], false, sizeof(bool) * output->cols);
+		cout << "Could not read the first frame of " << argv[1] << endl;
+		return 0;
 	}
 
-	queue<Point> q;
-	q.push(s);
-	visited[s.y][s.x] = true;
+	vector<seedPoint> seeds;
+	if(!SidecarSeeds::read(argv[1], &seeds))
+	{
+		namedWindow("gray", WINDOW_NORMAL);
+		imshow("gray", gray);
+		waitKey(100);
 
-	while(!q.empty())
+		vector<Point> clicked;
+		cout << "Select a point from the foreground and background respectively and then press any key" << endl;
+		setMouseCallback("gray", initialMouseCallback, &clicked);
+		waitKey(0);
+		setMouseCallback("gray", finalMouseCallback, NULL);
+
+		for(size_t k = 0; k < clicked.size() && k < 2; k++)
+		{
+			seedPoint seed = {clicked[k].x, clicked[k].y, k == 0 ? 1 : -1};
+			seeds.push_back(seed);
+		}
+	}
+
+	WeightTable<capType> table = model.table();
+	vector<Point> foreground, background;
+	for(size_t k = 0; k < seeds.size(); k++)
 	{
-		Point temp = q.front();
-		q.pop();
+		if(seeds[k].x >= 0 && seeds[k].x < gray.cols && seeds[k].y >= 0 && seeds[k].y < gray.rows && seeds[k].label != 0)
+		{
+			(seeds[k].label > 0 ? foreground : background).push_back(Point(seeds[k].x, seeds[k].y));
+		}
+	}
+	vector<valueType> regions; // from the seed regions of the first frame
+	regionTerms(model, gray, foreground, background, &regions);
 
-		auto it = adjList[temp.y][temp.x].begin();
-		while(it != adjList[temp.y][temp.x].end())
+	graphType graph(gray.rows, gray.cols);
+	buildGraph(gray, table, &graph);
+	if(!regions.empty())
+	{
+		linkTerminals(gray, regions, &graph);
+	}
+	vector<bool> seeded(graph.size(), false);
+	for(size_t k = 0; k < seeds.size(); k++)
+	{
+		if(graph.contains(seeds[k].x, seeds[k].y) && seeds[k].label != 0)
 		{
-			if((*it).weight > 0 && !visited[(*it).pt.y][(*it).pt.x])
-			{
-				q.push((*it).pt);
-				visited[(*it).pt.y][(*it).pt.x] = true;
-			}
-			it++;
+			graph.terminal[graph.index(seeds[k].x, seeds[k].y)] = seeds[k].label > 0 ? graphType::traits::infinity() : -graphType::traits::infinity();
+			seeded[graph.index(seeds[k].x, seeds[k].y)] = true;
 		}
 	}
 
-	for(int i = 0; i < output->rows; i++)
+	BKMaxflow<capType> bk(&graph);
+	Mat reference = gray.clone(); // the intensities the capacities were computed from
+	Mat mask(gray.rows, gray.cols, CV_8UC1);
+	vector<int> changed;
+
+	for(int k = 0; ; k++)
 	{
-		for(int j = 0; j < output->cols; j++)
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		int updated = 0;
+
+		if(k > 0)
 		{
-			if(visited[i][j]) // nodes reachable from source vertex
+			if(gray.rows != graph.rows || gray.cols != graph.cols)
 			{
-				auto it = originalAdjList[i][j].begin();
-				while(it != originalAdjList[i][j].end())
+				cout << name << " has a different size, stopping" << endl;
+				break;
+			}
+
+			changed.clear();
+			for(int i = 0; i < gray.rows; i++)
+			{
+				const uchar* cur = gray.ptr<uchar>(i);
+				uchar* ref = reference.ptr<uchar>(i);
+				for(int j = 0; j < gray.cols; j++)
 				{
-					if(!visited[(*it).pt.y][(*it).pt.x]) // if it has an edge to a non-reachable vertex in the original graph, that edge is part of the min cut
+					if(abs(cur[j] - ref[j]) > tolerance)
 					{
-						output->at<uchar>(i, j) = 255;
-						output->at<uchar>((*it).pt.y, (*it).pt.x) = 255;
+						ref[j] = cur[j];
+						changed.push_back(i * gray.cols + j);
 					}
-					it++;
 				}
 			}
+
+			for(size_t c = 0; c < changed.size(); c++)
+			{
+				int p = changed[c];
+				graph.forEachNeighbour(p % graph.cols, p / graph.cols, [&](int q, int d) // an edge between two changed pixels is only updated once
+				{
+					int weight = table(reference.at<uchar>(p / graph.cols, p % graph.cols), reference.at<uchar>(q / graph.cols, q % graph.cols));
+					if(weight != graph.capacity[d][p])
+					{
+						bk.setCapacity(p, d, weight);
+						updated++;
+					}
+				});
+				if(!regions.empty() && !seeded[p])
+				{
+					bk.setTerminal(p, regions[reference.at<uchar>(p / graph.cols, p % graph.cols)]);
+				}
+			}
+		}
+
+		INSTRUMENT_BEGIN(PHASE_SOLVE);
+		bk.maxflow();
+		INSTRUMENT_END(PHASE_SOLVE);
+		double milliseconds = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+
+		INSTRUMENT_BEGIN(PHASE_CUT_EXTRACTION);
+		for(int p = 0; p < graph.size(); p++)
+		{
+			mask.at<uchar>(p / graph.cols, p % graph.cols) = bk.segment(p) == BKMaxflow<capType>::SOURCE ? 255 : 0;
+		}
+		INSTRUMENT_END(PHASE_CUT_EXTRACTION);
+
+		INSTRUMENT_BEGIN(PHASE_RENDER);
+		string path = name + (frames.isMapped() ? ".mask.pgm" : ".mask.png");
+		if(frames.isMapped())
+		{
+			writeMask(path, mask);
+		}
+		else
+		{
+			imwrite(path, mask);
+		}
+		INSTRUMENT_END(PHASE_RENDER);
+		cout << "frame " << k << ": " << changed.size() << " pixels changed, " << updated << " edges updated, " << milliseconds << " ms, written to " << path << endl;
+
+		if(!frames.read(&gray, &name))
+		{
+			break;
+		}
+	}
+
+	return 0;
+}
+
+// capacity models
+
+int capacityOptions(int first, int argc, char** argv, capacityModel* model) // takes the model options out of argv[first..]; returns the new argc
+{
+	model->weights = "linear";
+	model->sigma = 10;
+	model->regionWeight = 0;
+
+	int kept = first;
+	for(int a = first; a < argc; a++)
+	{
+		string value(argv[a]);
+		if(value == "w=linear" || value == "w=contrast" || value == "w=colour")
+		{
+			model->weights = value.substr(2);
+		}
+		else if(value.size() >= 3 && value[1] == '=' && (value[0] == 's' || value[0] == 'r'))
+		{
+			double number = atof(value.c_str() + 2);
+			if(value[0] == 's' && number > 0)
+			{
+				model->sigma = number;
+			}
+			else if(value[0] == 'r' && number >= 0)
+			{
+				model->regionWeight = number;
+			}
+			else
+			{
+				cout << "Ignoring " << value << endl;
+			}
+		}
+		else if(value.size() >= 2 && value[1] == '=')
+		{
+			cout << "Ignoring " << value << ", expected w=linear|contrast|colour, s=<sigma> or r=<region weight>" << endl;
+		}
+		else
+		{
+			argv[kept++] = argv[a];
+		}
+	}
+	return kept;
+}
+
+// terminal link of every intensity from the histograms of the seed regions; false (and empty) without region terms
+bool regionTerms(const capacityModel& model, const Mat& gray, const vector<Point>& foreground, const vector<Point>& background, vector<valueType>* byIntensity)
+{
+	byIntensity->clear();
+	if(model.regionWeight <= 0)
+	{
+		return false;
+	}
+
+	SeedHistograms histograms;
+	for(int k = 0; k < 2; k++)
+	{
+		const vector<Point>& seeds = k == 0 ? foreground : background;
+		for(size_t i = 0; i < seeds.size(); i++)
+		{
+			histograms.addRegion(gray.data, gray.step, gray.rows, gray.cols, seeds[i].x, seeds[i].y, SEED_REGION_RADIUS, k == 0 ? 1 : -1);
 		}
 	}
+	byIntensity->resize(256);
+	histograms.terminalTable(model.regionWeight, byIntensity->data());
+	return true;
+}
 
-	for(int i = 0; i < output->rows; i++)
+void linkTerminals(const Mat& gray, const vector<valueType>& byIntensity, graphType* graph) // before the seeds are linked
+{
+	for(int i = 0; i < gray.rows; i++)
 	{
-		delete [] visited[i];
+		const uchar* row = gray.ptr<uchar>(i);
+		valueType* terminal = &graph->terminal[i * graph->cols];
+		for(int j = 0; j < gray.cols; j++)
+		{
+			terminal[j] = byIntensity[row[j]];
+		}
 	}
+}
 
-	delete [] visited;
-}
\ No newline at end of file
+// input and output of mapped files
+
+bool readGray(const string& path, MappedImage* mapped, Mat* gray) // 8 bit PGM, PPM and raw files are mapped and used without decoding, others are decoded
+{
+	*gray = Mat(); // never convert into a view of the previous mapping
+	if(mapped->open(path))
+	{
+		Mat view(mapped->rows, mapped->cols, CV_8UC(mapped->channels), (void*)mapped->data, mapped->step); // read-only
+		if(mapped->channels == 1)
+		{
+			*gray = view;
+		}
+		else
+		{
+			cvtColor(view, *gray, COLOR_RGB2GRAY);
+		}
+		return true;
+	}
+
+	Mat input = imread(path, IMREAD_COLOR);
+	if(input.empty())
+	{
+		return false;
+	}
+	cvtColor(input, *gray, COLOR_BGR2GRAY); // convert to grayscale (weighted formula)
+	return true;
+}
+
+// for colour weights: the colour pixels (R G B if mapped, B G R if decoded; the colour distance does not depend on the order) and
+// the grayscale image; a mapped gray file gives the same view for both
+bool readColour(const string& path, MappedImage* mapped, Mat* image, Mat* gray)
+{
+	*image = Mat();
+	*gray = Mat();
+	if(mapped->open(path))
+	{
+		*image = Mat(mapped->rows, mapped->cols, CV_8UC(mapped->channels), (void*)mapped->data, mapped->step);
+		if(mapped->channels == 1)
+		{
+			*gray = *image;
+		}
+		else
+		{
+			cvtColor(*image, *gray, COLOR_RGB2GRAY);
+		}
+		return true;
+	}
+
+	*image = imread(path, IMREAD_COLOR);
+	if(image->empty())
+	{
+		return false;
+	}
+	cvtColor(*image, *gray, COLOR_BGR2GRAY);
+	return true;
+}
+
+// the image of a server request: from its file (mapped if possible) or decoded from its bytes; image is the colour pixels if colour
+// is set, otherwise gray
+bool readRequest(const serverRequest& request, bool colour, MappedImage* mapped, Mat* image, Mat* gray)
+{
+	if(!request.path.empty())
+	{
+		if(colour)
+		{
+			return readColour(request.path, mapped, image, gray);
+		}
+		if(!readGray(request.path, mapped, gray))
+		{
+			return false;
+		}
+		*image = *gray;
+		return true;
+	}
+
+	if(mapped->data != NULL) // the views of the previous request's file must not be written to
+	{
+		*image = Mat();
+		*gray = Mat();
+		mapped->close();
+	}
+	Mat decoded = imdecode(Mat(1, (int)request.bytes.size(), CV_8UC1, (void*)request.bytes.data()), IMREAD_COLOR);
+	if(decoded.empty())
+	{
+		return false;
+	}
+	cvtColor(decoded, *gray, COLOR_BGR2GRAY);
+	*image = colour ? decoded : *gray;
+	return true;
+}
+
+bool writeMask(const string& path, const Mat& mask) // binary PGM, stored row by row into the mapped file
+{
+	MappedOutput output;
+	if(!output.create(path, mask.rows, mask.cols, 1, 255))
+	{
+		return false;
+	}
+	for(int i = 0; i < mask.rows; i++)
+	{
+		memcpy(output.row(i), mask.ptr<uchar>(i), mask.cols);
+	}
+	return output.close();
+}
@@ -1,319 +1,585 @@
 #include <iostream>
-#include <list>
+#include <vector>
+#include <thread>
+#include <string>
 #include <math.h>
-#include <limits.h>
 
 #include <opencv2/opencv.hpp>
 
+#include "mstSegmentation.h"
+#include "streamingMstSegmentation.h"
+#include "instrumentation.h"
+#include "batchPipeline.h"
+#include "mappedImage.h"
+#include "segmentationServer.h"
+
 using namespace std;
 using namespace cv;
 
-enum connectivity // directions
-{
-	N = 1, NE, E, SE, S, SW, W, NW
-};
-
-struct edge
-{
-	Point u, v;
-	int weight;
-};
-
-struct node
+enum weightModel // distance between the colours of two neighbouring pixels
 {
-	Point parent;
-	int maxEdgeWeight;
-	int rank;
+	GRAY_WEIGHTS = 0, RGB_WEIGHTS, LAB_WEIGHTS
 };
 
-Point neighbour(Point, int, int, int);
-bool compareFunction(const edge& first, const edge& second);
-Vec3b colourImage(Mat*, int*, int, int, int, vector<vector<node>>, vector<vector<bool>>*);
+void computeEdgeWeights(const Mat&, bool, weightModel, MstSegmentation*, int, Mat*);
+int labelSegments(const ConcurrentUnionFind&, int, int, int, Mat*);
+void colourSegments(const Mat&, int, Mat*);
+int runBatch(int, char**);
+int runServer(int, char**);
+void labelImage(const Mat&, int, Mat*);
+bool readImage(const string&, MappedImage*, Mat*);
+bool readRequest(const serverRequest&, MappedImage*, Mat*);
+int streamSegments(const string&, const Mat&, MappedImage*, weightModel, int, int);
 
 int main(int argc, char** argv)
 {
-	Mat input = imread(argv[1], IMREAD_COLOR);
-	Mat gray_input;
-
-	cvtColor(input, gray_input, COLOR_BGR2GRAY); // convert to grayscale (weighted formula)
-	
-	Mat output(gray_input.rows, gray_input.cols, gray_input.type()%7 + 16, Scalar(0, 0, 0)); // initialize same sized image - all black
-
-	namedWindow("input", WINDOW_NORMAL); // display grayscale input
-	imshow("input", gray_input);
-
-	waitKey(0);
+	if(argc >= 2 && string(argv[1]) == "batch") // headless: "batch <directory or list file> [threads] [w=...] [t=... n=...]"
+	{
+		return runBatch(argc, argv);
+	}
+	if(argc >= 2 && string(argv[1]) == "serve") // resident: "serve <socket path> [threads]", see segmentationServer.h
+	{
+		return runServer(argc, argv);
+	}
 
-	int segmentCount = gray_input.rows * gray_input.cols; // number of initial segments
+	INSTRUMENT_REPORT(string(argv[1]) + ".stats.json"); // with -DINSTRUMENTATION: phase times and solver counters of this run
 
-	list<edge> edgeList; // list of all edges
+	INSTRUMENT_BEGIN(PHASE_DECODE);
+	MappedImage mapped; // 8 bit PGM/PPM/raw input is read in place
+	Mat input;
 
-	vector<vector<node>> disjointSet; // structure to represent disjoint sets for union/find operations
+	if(!readImage(argv[1], &mapped, &input))
+	{
+		cout << "Could not read " << argv[1] << endl;
+		return 0;
+	}
+	INSTRUMENT_END(PHASE_DECODE);
 
-	disjointSet.resize(gray_input.rows);
+	int threads = argc >= 3 ? atoi(argv[2]) : (int)thread::hardware_concurrency(); // optional second argument: number of threads
+	threads = max(threads, 1);
 
-	for(int i = 0; i < gray_input.rows ; i++)
+	weightModel model = GRAY_WEIGHTS; // "w=gray", "w=rgb" or "w=lab"
+	vector<string> cuts; // thresholds ("t=<weight>") and segment counts ("n=<segments>")
+	int bandRows = 0; // "b=<rows>": streaming over bands of rows
+	for(int a = 3; a < argc; a++)
 	{
-		disjointSet[i].resize(gray_input.cols);
-
-		for(int j = 0; j < gray_input.cols; j++)
+		string value(argv[a]);
+		if(value == "w=gray" || value == "w=rgb" || value == "w=lab")
 		{
-			edge temp;
-			temp.u.x = j;
-			temp.u.y = i;
-
-			temp.v = neighbour(temp.u, 7, gray_input.cols, gray_input.rows); // W neighbour
-			if(temp.v != Point(-1, -1))
-			{
-				temp.weight = abs(gray_input.at<uchar>(temp.v) - gray_input.at<uchar>(temp.u));
-				edgeList.push_back(temp);
-			}
+			model = value == "w=gray" ? GRAY_WEIGHTS : value == "w=rgb" ? RGB_WEIGHTS : LAB_WEIGHTS;
+		}
+		else if(value.size() >= 3 && value[1] == '=' && (value[0] == 't' || value[0] == 'n'))
+		{
+			cuts.push_back(value);
+		}
+		else if(value.size() >= 3 && value[0] == 'b' && value[1] == '=')
+		{
+			bandRows = max(atoi(value.c_str() + 2), 1);
+		}
+		else
+		{
+			cout << "Ignoring " << value << ", expected t=<threshold>, n=<segments>, w=gray|rgb|lab or b=<rows>" << endl;
+		}
+	}
 
-			temp.v = neighbour(temp.u, 8, gray_input.cols, gray_input.rows); // NW neighbour
-			if(temp.v != Point(-1, -1))
-			{
-				temp.weight = abs(gray_input.at<uchar>(temp.v) - gray_input.at<uchar>(temp.u));
-				edgeList.push_back(temp);
-			}
+	if(bandRows > 0) // streaming: neither the edge weights nor the label map of the whole image are ever in memory
+	{
+		if(!cuts.empty())
+		{
+			cout << "Ignoring the cuts: the merge hierarchy needs the whole image" << endl;
+		}
+		return streamSegments(argv[1], input, &mapped, model, bandRows, threads);
+	}
 
-			temp.v = neighbour(temp.u, 1, gray_input.cols, gray_input.rows); // N neighbour
-			if(temp.v != Point(-1, -1))
-			{
-				temp.weight = abs(gray_input.at<uchar>(temp.v) - gray_input.at<uchar>(temp.u));
-				edgeList.push_back(temp);
-			}
+	INSTRUMENT_BEGIN(PHASE_GRAPH_BUILD);
+	MstSegmentation segmentation(input.rows, input.cols); // edge weights of the 8-connected pixel graph
+	Mat converted;
+	computeEdgeWeights(input, mapped.data != NULL, model, &segmentation, threads, &converted);
+	INSTRUMENT_END(PHASE_GRAPH_BUILD);
 
-			temp.v = neighbour(temp.u, 2, gray_input.cols, gray_input.rows); // NE neighbour
-			if(temp.v != Point(-1, -1))
-			{
-				temp.weight = abs(gray_input.at<uchar>(temp.v) - gray_input.at<uchar>(temp.u));
-				edgeList.push_back(temp);
-			}
+	if(!cuts.empty()) // sweep: the merge hierarchy is built once and cut at every threshold or segment count given
+	{
+		INSTRUMENT_BEGIN(PHASE_SOLVE);
+		SegmentationHierarchy hierarchy(input.rows * input.cols);
+		segmentation.buildHierarchy(&hierarchy, threads);
+		INSTRUMENT_END(PHASE_SOLVE);
 
-			disjointSet[i][j].parent.x = j;
-			disjointSet[i][j].parent.y = i;
-			disjointSet[i][j].maxEdgeWeight = INT_MAX; // denotes independent segment
-			disjointSet[i][j].rank = 1;
+		for(size_t c = 0; c < cuts.size(); c++)
+		{
+			string value = cuts[c];
+			int number = atoi(value.c_str() + 2);
+			INSTRUMENT_BEGIN(PHASE_CUT_EXTRACTION);
+			ConcurrentUnionFind disjointSet(hierarchy.size);
+			hierarchy.cut(value[0] == 't' ? hierarchy.mergesAtThreshold(number) : hierarchy.mergesForSegments(number), &disjointSet);
+
+			Mat labels;
+			int segmentCount = labelSegments(disjointSet, input.rows, input.cols, threads, &labels);
+			INSTRUMENT_END(PHASE_CUT_EXTRACTION);
+
+			INSTRUMENT_BEGIN(PHASE_RENDER);
+			Mat output(input.rows, input.cols, CV_8UC3, Scalar(0, 0, 0));
+			colourSegments(labels, segmentCount, &output);
+
+			string path = string(argv[1]) + "." + value[0] + value.substr(2) + ".png";
+			imwrite(path, output);
+			INSTRUMENT_END(PHASE_RENDER);
+			cout << value << ": " << segmentCount << " segments, written to " << path << endl;
 		}
+
+		return 0;
 	}
 
-	edgeList.sort(compareFunction); // sort in ascending order according to weights
+	Mat output(input.rows, input.cols, CV_8UC3, Scalar(0, 0, 0)); // initialize same sized image - all black
 
-	auto it = edgeList.begin();
-	while(it != edgeList.end()) // iterate through sorted edges
+	Mat gray_input;
+	if(input.channels() == 1) // mapped gray input is shown as it is
 	{
-		edge temp = *it;
-
-		Point uParent = temp.u;
-		Point vParent = temp.v;
+		gray_input = input;
+	}
+	else
+	{
+		cvtColor(input, gray_input, mapped.data != NULL ? COLOR_RGB2GRAY : COLOR_BGR2GRAY); // convert to grayscale (weighted formula)
+	}
 
-		while(disjointSet[uParent.y][uParent.x].parent != uParent) // find parent of "u"
-		{
-			uParent = disjointSet[uParent.y][uParent.x].parent;
-		}
-		while(disjointSet[vParent.y][vParent.x].parent != vParent) // find parent of "v"
-		{
-			vParent = disjointSet[vParent.y][vParent.x].parent;
-		}
+	namedWindow("input", WINDOW_NORMAL); // display grayscale input
+	imshow("input", gray_input);
 
-		if(uParent != vParent) // if they are not in the same segment
-		{
-			// if the edge weight is lesser than max weight of either segments (comparing edge weight with "maxEdgeWeight" of parent of both segments)
-			if(temp.weight < disjointSet[uParent.y][uParent.x].maxEdgeWeight || temp.weight < disjointSet[vParent.y][vParent.x].maxEdgeWeight)
-			{
-				// calculation of maximum weight, ignoring INT_MAX 
-				int newMaxWeight = disjointSet[temp.u.y][temp.u.x].maxEdgeWeight;
-				if(newMaxWeight == INT_MAX)
-				{
-					newMaxWeight = disjointSet[temp.v.y][temp.v.x].maxEdgeWeight;
-				}
+	waitKey(0);
 
-				if(newMaxWeight < disjointSet[temp.v.y][temp.v.x].maxEdgeWeight && disjointSet[temp.v.y][temp.v.x].maxEdgeWeight != INT_MAX)
-				{
-					newMaxWeight = disjointSet[temp.v.y][temp.v.x].maxEdgeWeight;
-				}
+	INSTRUMENT_BEGIN(PHASE_SOLVE);
+	ConcurrentUnionFind disjointSet(input.rows * input.cols); // structure to represent disjoint sets for union/find operations
 
-				if(disjointSet[temp.u.y][temp.u.x].maxEdgeWeight == INT_MAX && disjointSet[temp.v.y][temp.v.x].maxEdgeWeight == INT_MAX)
-				{
-					newMaxWeight = temp.weight;
-				}
+	segmentation.segment(&disjointSet, threads);
+	INSTRUMENT_END(PHASE_SOLVE);
 
-				// update maximum weight in all parents till root --> !! Does NOT update "maxEdgeWeight" in all pixels belonging to that segment !!
+	Mat labels; // segment of every pixel, 0 .. segmentCount - 1
 
-				uParent = temp.u;
-				vParent = temp.v;
+	INSTRUMENT_BEGIN(PHASE_CUT_EXTRACTION);
+	int segmentCount = labelSegments(disjointSet, input.rows, input.cols, threads, &labels);
+	INSTRUMENT_END(PHASE_CUT_EXTRACTION);
 
-				disjointSet[uParent.y][uParent.x].maxEdgeWeight = newMaxWeight;
-				while(disjointSet[uParent.y][uParent.x].parent != uParent)
-				{
-					uParent = disjointSet[uParent.y][uParent.x].parent;
-					disjointSet[uParent.y][uParent.x].maxEdgeWeight = newMaxWeight;
-				}
+	INSTRUMENT_BEGIN(PHASE_RENDER);
+	colourSegments(labels, segmentCount, &output);
 
-				disjointSet[vParent.y][vParent.x].maxEdgeWeight = newMaxWeight;
-				while(disjointSet[vParent.y][vParent.x].parent != vParent)
-				{
-					vParent = disjointSet[vParent.y][vParent.x].parent;
-					disjointSet[vParent.y][vParent.x].maxEdgeWeight = newMaxWeight;
-				}
+	namedWindow("final", WINDOW_NORMAL); // display output image
+	imshow("final", output);
+	INSTRUMENT_END(PHASE_RENDER);
 
-				// do union
+	waitKey(0);
 
-				if(disjointSet[uParent.y][uParent.x].rank < disjointSet[vParent.y][vParent.x].rank)
-				{
-					disjointSet[uParent.y][uParent.x].parent = vParent;
-				}
-				else if(disjointSet[vParent.y][vParent.x].rank < disjointSet[uParent.y][uParent.x].rank)
-				{
-					disjointSet[vParent.y][vParent.x].parent = uParent;
-				}
-				else
-				{
-					disjointSet[uParent.y][uParent.x].rank++;
-					disjointSet[vParent.y][vParent.x].parent = uParent;
-				}
+	return 0;
+}
 
-				segmentCount--; // update count
-			}	
-		}
-		
-		it++;
-	}
+// edge weights: the image is converted once to the pixels the weight model compares (gray, B G R or Lab, interleaved), unless the
+// input already is, and every thread takes a block of its rows. Every direction is a pair of row pointers, so one kernel call per
+// row and direction computes the weights without per-pixel bounds checks (MstSegmentation::weightRow).
 
-	vector<vector<bool>> visited; // 2D array to keep track of which nodes have been coloured
-	visited.resize(gray_input.rows);
+int weightChannels(const Mat& input, weightModel model) // bytes per compared pixel
+{
+	// the colour distance of a gray input (B = G = R) is its gray difference
+	return model == GRAY_WEIGHTS || (model == RGB_WEIGHTS && input.channels() == 1) ? 1 : 3;
+}
 
-	int colourCount = 0;
+bool convertsPixels(const Mat& input, weightModel model) // false if the weights come from the input pixels themselves
+{
+	return model == LAB_WEIGHTS || input.channels() != weightChannels(input, model);
+}
 
-	for(int i = 0; i < gray_input.rows; i++)
+Mat grayLabColours() // Lab colour of every gray level, as cvtColor gives it for B = G = R
+{
+	Mat levels(1, 256, CV_8UC1), colours;
+	for(int v = 0; v < 256; v++)
 	{
-		visited[i].resize(gray_input.cols);
-		fill(visited[i].begin(), visited[i].end(), false);
+		levels.at<uchar>(0, v) = (uchar)v;
 	}
+	cvtColor(levels, colours, COLOR_GRAY2BGR);
+	cvtColor(colours, colours, COLOR_BGR2Lab);
+	return colours;
+}
 
-	for(int i = 0; i < gray_input.rows; i++)
+void convertPixels(const Mat& input, bool rgbOrder, weightModel model, Mat* pixels) // pixels keeps its memory if the size fits
+{
+	if(model == GRAY_WEIGHTS)
 	{
-		for(int j = 0; j < gray_input.cols; j++)
+		cvtColor(input, *pixels, rgbOrder ? COLOR_RGB2GRAY : COLOR_BGR2GRAY); // same weighted formula as the whole image
+	}
+	else if(input.channels() == 1) // mapped gray input with Lab weights
+	{
+		static const Mat colours = grayLabColours();
+		pixels->create(input.rows, input.cols, CV_8UC3);
+		for(int i = 0; i < input.rows; i++)
 		{
-			if(!visited[i][j])
+			const uchar* level = input.ptr<uchar>(i);
+			uchar* pixel = pixels->ptr<uchar>(i);
+			for(int j = 0; j < input.cols; j++)
 			{
-				colourImage(&output, &colourCount, segmentCount, i, j, disjointSet, &visited);
+				memcpy(pixel + 3 * j, colours.ptr<uchar>(0) + 3 * level[j], 3);
 			}
 		}
 	}
+	else
+	{
+		cvtColor(input, *pixels, rgbOrder ? COLOR_RGB2Lab : COLOR_BGR2Lab); // 8 bit Lab: L scaled to 0..255, a and b offset by 128
+	}
+}
 
-	namedWindow("final", WINDOW_NORMAL); // display output image
-	imshow("final", output);
+void edgeWeightRows(const Mat* pixels, MstSegmentation* segmentation, int begin, int end)
+{
+	for(int i = begin; i < end; i++)
+	{
+		segmentation->weightRow(i, pixels->ptr<uchar>(i), pixels->ptr<uchar>(max(i - 1, 0)), pixels->channels());
+	}
+}
 
-	waitKey(0);
+void computeEdgeWeights(const Mat& input, bool rgbOrder, weightModel model, MstSegmentation* segmentation, int threads, Mat* converted)
+{
+	const Mat* pixels = &input; // the distance does not depend on the channel order
+	if(convertsPixels(input, model))
+	{
+		convertPixels(input, rgbOrder, model, converted);
+		pixels = converted;
+	}
 
-	return 0;
+	threads = min(threads, max(input.rows, 1));
+
+	vector<thread> workers;
+	for(int b = 0; b < threads; b++)
+	{
+		workers.push_back(thread(edgeWeightRows, pixels, segmentation, (int)((long long)input.rows * b / threads), (int)((long long)input.rows * (b + 1) / threads)));
+	}
+	for(int b = 0; b < threads; b++)
+	{
+		workers[b].join();
+	}
 }
 
-Point neighbour(Point input, int direction, int cols, int rows) // calculates neighbour based on direction input
+// output
+
+void colourRows(const Mat* labels, const vector<Vec3b>* palette, Mat* output, int begin, int end)
 {
-	switch(direction)
+	for(int i = begin; i < end; i++)
 	{
-		case N:
+		for(int j = 0; j < labels->cols; j++)
 		{
-			input.y--;
-			break;
+			output->at<Vec3b>(i, j) = (*palette)[labels->at<int>(i, j)];
 		}
+	}
+}
+
+int labelSegments(const ConcurrentUnionFind& disjointSet, int rows, int cols, int threads, Mat* labels) // segment of every pixel, 0 .. count - 1; returns the count
+{
+	labels->create(rows, cols, CV_32SC1); // reuses the buffer of a label map of the same size
+	return MstSegmentation::labelSegments(disjointSet, rows, cols, labels->ptr<int>(0), threads);
+}
+
+void colourSegments(const Mat& labels, int segmentCount, Mat* output) // one colour per segment from a palette
+{
+	vector<Vec3b> palette(segmentCount);
+	for(int k = 0; k < segmentCount; k++)
+	{
+		unsigned int hash = (unsigned int)k * 2654435761u; // Knuth's multiplicative hash spreads consecutive labels over the colour cube
+		palette[k] = Vec3b((uchar)((hash >> 8) | 32), (uchar)((hash >> 16) | 32), (uchar)((hash >> 24) | 32)); // never black
+	}
 
-		case NE:
+	int threads = max(1, min(labels.rows, (int)thread::hardware_concurrency()));
+	vector<thread> workers;
+	for(int b = 0; b < threads; b++)
+	{
+		workers.push_back(thread(colourRows, &labels, &palette, output, (int)((long long)labels.rows * b / threads), (int)((long long)labels.rows * (b + 1) / threads)));
+	}
+	for(int b = 0; b < threads; b++)
+	{
+		workers[b].join();
+	}
+}
+
+// streaming: the image is weighed and segmented band by band (StreamingMstSegmentation) and the label map is written band by band
+// into a mapped "<image path>.segments.pgm" (".ppm" for more than 65536 segments). With PGM, PPM and raw input the rows of the
+// image are released as soon as they are segmented, so memory depends on the band size only; other input is decoded as a whole.
+
+int streamSegments(const string& path, const Mat& input, MappedImage* mapped, weightModel model, int bandRows, int threads)
+{
+	bool rgbOrder = mapped->data != NULL;
+	int channels = weightChannels(input, model);
+	StreamingMstSegmentation segmentation(input.rows, input.cols, channels, bandRows, threads);
+
+	INSTRUMENT_BEGIN(PHASE_SOLVE);
+	bool segmented = segmentation.segment([&](int y, vector<uchar>* row)
+	{
+		Mat source = input.rowRange(y, y + 1), pixels(1, input.cols, CV_8UC(channels), row->data()); // converted into the row buffer
+		if(convertsPixels(input, model))
 		{
-			input.x++;
-			input.y--;
-			break;
+			convertPixels(source, rgbOrder, model, &pixels);
 		}
-
-		case E:
+		else
 		{
-			input.x++;
-			break;
+			source.copyTo(pixels);
 		}
+	}, [&](int y)
+	{
+		mapped->release(y);
+	});
+	INSTRUMENT_END(PHASE_SOLVE);
+	if(!segmented)
+	{
+		cout << "Could not write the temporary file" << endl;
+		return 1;
+	}
+
+	INSTRUMENT_BEGIN(PHASE_CUT_EXTRACTION);
+	MappedOutput output;
+	string outputPath;
+	bool written = output.createLabels(path + ".segments", input.rows, input.cols, segmentation.segmentCount() - 1, &outputPath) && segmentation.writeLabels([&](int y, const int* labels)
+	{
+		output.storeLabels(y, labels);
+		output.release(y + 1);
+	});
+	written = output.close() && written;
+	INSTRUMENT_END(PHASE_CUT_EXTRACTION);
+	if(!written)
+	{
+		cout << "Could not write " << outputPath << endl;
+		return 1;
+	}
+
+	cout << segmentation.segmentCount() << " segments (" << segmentation.seamMerges << " merges across band seams), written to " << outputPath << endl;
+	return 0;
+}
+
+// batch mode: every image is segmented on one thread, the images in parallel. The label map is written to "<image path>.segments.png",
+// or to "<image path>.segments.t<weight>.png" and "<image path>.segments.n<segments>.png" for every cut of the merge hierarchy.
+// PGM, PPM and raw input gives mapped ".pgm" label maps instead (".ppm" for more than 65536 segments).
+
+struct mstJob
+{
+	string path;
+	MappedImage mapped; // set for PGM, PPM and raw input; input is then a view of it
+	Mat input;
+	vector<Mat> labels; // one per cut, or the single segmentation
+	vector<int> counts;
+};
 
-		case SE:
+int runBatch(int argc, char** argv)
+{
+	if(argc < 3)
+	{
+		cout << "Usage : ./mst batch <directory or list file> [threads] [w=gray|rgb|lab] [t=<threshold>] [n=<segments>]" << endl;
+		return 0;
+	}
+
+	string input(argv[2]);
+	int threads = argc >= 4 ? atoi(argv[3]) : (int)thread::hardware_concurrency();
+
+	weightModel model = GRAY_WEIGHTS;
+	vector<string> cuts;
+	for(int a = 4; a < argc; a++)
+	{
+		string value(argv[a]);
+		if(value == "w=gray" || value == "w=rgb" || value == "w=lab")
 		{
-			input.x++;
-			input.y++;
-			break;
+			model = value == "w=gray" ? GRAY_WEIGHTS : value == "w=rgb" ? RGB_WEIGHTS : LAB_WEIGHTS;
 		}
-
-		case S:
+		else if(value.size() >= 3 && value[1] == '=' && (value[0] == 't' || value[0] == 'n'))
 		{
-			input.y++;
-			break;
+			cuts.push_back(value);
 		}
+	}
+
+	INSTRUMENT_REPORT(input + ".stats.json");
+
+	vector<string> paths;
+	if(!BatchPipeline::listImages(input, &paths))
+	{
+		cout << "Could not read " << input << endl;
+		return 1;
+	}
 
-		case SW:
+	int failures = BatchPipeline::run<mstJob>(paths, threads, [&](const string& path, mstJob* job)
+	{
+		job->path = path;
+		if(!readImage(path, &job->mapped, &job->input))
 		{
-			input.x--;
-			input.y++;
-			break;
+			cout << "Could not read " << path << endl;
+			return false;
 		}
+		return true;
+	}, [&](mstJob* job)
+	{
+		int rows = job->input.rows, cols = job->input.cols;
+		MstSegmentation segmentation(rows, cols);
+		Mat converted;
+		computeEdgeWeights(job->input, job->mapped.data != NULL, model, &segmentation, 1, &converted);
 
-		case W:
+		if(cuts.empty())
 		{
-			input.x--;
-			break;
+			ConcurrentUnionFind disjointSet(rows * cols);
+			segmentation.segment(&disjointSet, 1);
+			job->labels.push_back(Mat());
+			job->counts.push_back(labelSegments(disjointSet, rows, cols, 1, &job->labels.back()));
+			return;
 		}
 
-		case NW:
+		SegmentationHierarchy hierarchy(rows * cols);
+		segmentation.buildHierarchy(&hierarchy, 1);
+		for(size_t c = 0; c < cuts.size(); c++)
 		{
-			input.x--;
-			input.y--;
-			break;
+			int number = atoi(cuts[c].c_str() + 2);
+			ConcurrentUnionFind disjointSet(hierarchy.size);
+			hierarchy.cut(cuts[c][0] == 't' ? hierarchy.mergesAtThreshold(number) : hierarchy.mergesForSegments(number), &disjointSet);
+			job->labels.push_back(Mat());
+			job->counts.push_back(labelSegments(disjointSet, rows, cols, 1, &job->labels.back()));
 		}
-	}
-	if(input.x < 0 || input.x >= cols || input.y < 0 || input.y >= rows)
+	}, [&](mstJob* job)
 	{
-		return Point(-1, -1);
-	}
-	return input;
+		for(size_t c = 0; c < job->labels.size(); c++)
+		{
+			string base = job->path + ".segments" + (cuts.empty() ? "" : "." + cuts[c].substr(0, 1) + cuts[c].substr(2)), path;
+			if(job->mapped.data != NULL) // PNM in, PNM out: the labels are stored straight into the mapped file
+			{
+				const Mat& labels = job->labels[c];
+				if(!MappedOutput::writeLabels(base, labels.ptr<int>(0), labels.step / sizeof(int), labels.rows, labels.cols, job->counts[c] - 1, &path))
+				{
+					cout << "Could not write " << path << endl;
+					return false;
+				}
+				continue;
+			}
+
+			Mat image;
+			labelImage(job->labels[c], job->counts[c], &image);
+			path = base + ".png";
+			if(!imwrite(path, image))
+			{
+				cout << "Could not write " << path << endl;
+				return false;
+			}
+		}
+		return true;
+	});
+
+	cout << paths.size() - failures << " of " << paths.size() << " images segmented" << endl;
+	return failures == 0 ? 0 : 1;
 }
 
-bool compareFunction(const edge& first, const edge& second) // compare function for sorting list of edges according to edge weights
+// server mode: "serve <socket path> [threads]" answers requests with "w=gray|rgb|lab" (default gray) and at most one cut of the merge
+// hierarchy ("t=<weight>" or "n=<segments>") with the label map, segments 0 .. count - 1
+
+struct mstWorker // everything a request needs, kept from one request to the next
 {
-	return (first.weight < second.weight);
-}
+	MappedImage mapped;
+	Mat input, labels, converted;
+	MstSegmentation segmentation;
 
-Vec3b colourImage(Mat* output, int* colourCount, int segmentCount, int i, int j, vector<vector<node>> disjointSet, vector<vector<bool>>* visited) // colours pixels
+	mstWorker() : segmentation(0, 0) {}
+};
+
+int runServer(int argc, char** argv)
 {
-	if(disjointSet[i][j].parent == Point(j, i)) // if pixel is in an independent segment or is the root of a segment
+	if(argc < 3)
 	{
-		if(output->at<Vec3b>(i, j) != Vec3b(0, 0, 0)) // if it has been coloured
-		{
-			(*visited)[i][j] = true;
+		cout << "Usage : ./mst serve <socket path> [threads]" << endl;
+		return 0;
+	}
+	int threads = argc >= 4 ? atoi(argv[3]) : (int)thread::hardware_concurrency();
 
-			return output->at<Vec3b>(i, j);
+	cout << "Listening on " << argv[2] << endl;
+	bool served = SegmentationServer::run<mstWorker>(argv[2], threads, [&](const serverRequest& request, mstWorker* worker, string* error)
+	{
+		string weights = request.value("w", "gray");
+		if(weights != "gray" && weights != "rgb" && weights != "lab")
+		{
+			*error = "expected w=gray|rgb|lab";
+			return false;
 		}
+		if(!readRequest(request, &worker->mapped, &worker->input))
+		{
+			*error = "could not read the image";
+			return false;
+		}
+		return true;
+	}, [&](const serverRequest& request, mstWorker* worker, serverResponse* response)
+	{
+		string weights = request.value("w", "gray");
+		weightModel model = weights == "gray" ? GRAY_WEIGHTS : weights == "rgb" ? RGB_WEIGHTS : LAB_WEIGHTS;
+		int rows = worker->input.rows, cols = worker->input.cols;
 
-		// if it has not been coloured, calculate new colour
-
-		(*colourCount)++;
-
-		Vec3b regionIntensity;
+		worker->segmentation.reset(rows, cols);
+		computeEdgeWeights(worker->input, worker->mapped.data != NULL, model, &worker->segmentation, 1, &worker->converted);
 
-		// each connected component is assigned a different colour calculated here
-		regionIntensity[0] = (255/segmentCount)*(*colourCount);
-		regionIntensity[1] = ((255/segmentCount)*((*colourCount)+1))%256;
-		regionIntensity[2] = ((255/segmentCount)*((*colourCount)-1))%256;
+		ConcurrentUnionFind disjointSet(rows * cols);
+		string threshold = request.value("t", ""), segments = request.value("n", "");
+		if(threshold.empty() && segments.empty())
+		{
+			worker->segmentation.segment(&disjointSet, 1);
+		}
+		else
+		{
+			SegmentationHierarchy hierarchy(rows * cols);
+			worker->segmentation.buildHierarchy(&hierarchy, 1);
+			hierarchy.cut(!threshold.empty() ? hierarchy.mergesAtThreshold(atoi(threshold.c_str())) : hierarchy.mergesForSegments(atoi(segments.c_str())), &disjointSet);
+		}
 
-		output->at<Vec3b>(i, j) = regionIntensity;
+		response->type = "labels";
+		response->rows = rows;
+		response->cols = cols;
+		response->count = labelSegments(disjointSet, rows, cols, 1, &worker->labels);
+		response->data.resize((size_t)rows * cols * sizeof(int));
+		for(int i = 0; i < rows; i++)
+		{
+			memcpy(&response->data[(size_t)i * cols * sizeof(int)], worker->labels.ptr<int>(i), cols * sizeof(int));
+		}
+	});
 
-		(*visited)[i][j] = true;
+	if(!served)
+	{
+		cout << "Could not listen on " << argv[2] << endl;
+		return 1;
+	}
+	return 0;
+}
 
-		return regionIntensity;
+void labelImage(const Mat& labels, int count, Mat* image) // 16 bit gray if the labels fit, otherwise 24 bit labels in B G R (B lowest)
+{
+	if(count <= 65536)
+	{
+		labels.convertTo(*image, CV_16UC1);
+		return;
 	}
 
-	// colour parent pixel recursively and colour this pixel with the same colour as parent
+	*image = Mat(labels.rows, labels.cols, CV_8UC3);
+	for(int i = 0; i < labels.rows; i++)
+	{
+		const int* label = labels.ptr<int>(i);
+		Vec3b* out = image->ptr<Vec3b>(i);
+		for(int j = 0; j < labels.cols; j++)
+		{
+			out[j] = Vec3b((uchar)label[j], (uchar)(label[j] >> 8), (uchar)(label[j] >> 16));
+		}
+	}
+}
 
-	Vec3b regionIntensity = colourImage(output, colourCount, segmentCount, disjointSet[i][j].parent.y, disjointSet[i][j].parent.x, disjointSet, visited);
+bool readImage(const string& path, MappedImage* mapped, Mat* input) // 8 bit PGM, PPM and raw files are mapped and used without decoding (gray or R G B), others are decoded to B G R
+{
+	*input = Mat();
+	if(mapped->open(path))
+	{
+		*input = Mat(mapped->rows, mapped->cols, CV_8UC(mapped->channels), (void*)mapped->data, mapped->step); // read-only
+		return true;
+	}
 
-	output->at<Vec3b>(i, j) = regionIntensity;
+	*input = imread(path, IMREAD_COLOR);
+	return !input->empty();
+}
 
-	(*visited)[i][j] = true;
+bool readRequest(const serverRequest& request, MappedImage* mapped, Mat* input) // the image of a server request: from its file as readImage(), or decoded from its bytes to B G R
+{
+	if(!request.path.empty())
+	{
+		return readImage(request.path, mapped, input);
+	}
 
-	return regionIntensity;
-}
\ No newline at end of file
+	*input = Mat(); // never decode into the view of the previous request's file
+	mapped->close();
+	*input = imdecode(Mat(1, (int)request.bytes.size(), CV_8UC1, (void*)request.bytes.data()), IMREAD_COLOR);
+	return !input->empty();
+}
@@ -0,0 +1,383 @@
+#ifndef MST_SEGMENTATION_H
+#define MST_SEGMENTATION_H
+
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <limits.h>
+#include <stdlib.h>
+
+#include "gridTopology.h"
+#include "concurrentUnionFind.h"
+#include "segmentationHierarchy.h"
+#include "edgeWeights.h"
+
+// Minimum spanning forest segmentation of the 8-connected pixel graph. Every pixel owns the edges to its W, NW, N and NE
+// neighbours, and the weight of every owned edge is stored in one plane per direction, filled row by row with weightRow().
+//
+// Edges are taken in ascending order of weight (ties in scan order: by owning pixel, then W, NW, N, NE) and an edge merges two segments
+// if its weight is below the largest merged edge weight of either segment, a single pixel counting as infinitely large.
+// Weights only grow along that order, so a segment that has merged once never passes the test again: an edge merges only while
+// one of its ends is still a single pixel, and that is the lightest edge of that pixel. The segments are therefore the connected
+// components of the lightest edges of all pixels, i.e. one Boruvka round, which every pixel can do on its own: segment().
+// buildHierarchy() continues with Boruvka rounds until the forest spans every connected part.
+
+class MstSegmentation
+{
+public:
+	typedef GridTopology<8> pixelGrid;
+
+	enum edgeDirection
+	{
+		EDGE_W = 0, EDGE_NW, EDGE_N, EDGE_NE, NUM_EDGE_DIRECTIONS
+	};
+
+	pixelGrid grid;
+	std::vector<unsigned char> weights[NUM_EDGE_DIRECTIONS]; // weights[e][p]: weight of the edge p owns in direction e, 0 if it leaves the image
+
+	MstSegmentation(int rows, int cols) : grid(rows, cols)
+	{
+		reset(rows, cols);
+	}
+
+	void reset(int rows, int cols) // all weights 0, for an image of the given size; the weight arrays keep their memory
+	{
+		grid = pixelGrid(rows, cols);
+		for(int e = 0; e < NUM_EDGE_DIRECTIONS; e++)
+		{
+			weights[e].assign((size_t)rows * cols, 0);
+		}
+	}
+
+	static int gridDirection(int e) // grid direction of an owned edge
+	{
+		static const int direction[NUM_EDGE_DIRECTIONS] = {GRID_W, GRID_NW, GRID_N, GRID_NE};
+		return direction[e];
+	}
+
+	static int ownedEdge(int d) // edge a pixel owns towards grid direction d, -1 if the neighbour owns it
+	{
+		static const int edge[pixelGrid::NUM_NEIGHBOURS] = {EDGE_N, -1, -1, EDGE_W, EDGE_NE, -1, -1, EDGE_NW};
+		return edge[d];
+	}
+
+	// weights of the edges row y owns; current, previous: rows y and y - 1 (unused for y == 0) of cols pixels with interleaved
+	// channels, 1 for the absolute difference or 3 for the scaled Euclidean distance. Rows can be filled by several threads at once.
+	void weightRow(int y, const unsigned char* current, const unsigned char* previous, int channels)
+	{
+		int cols = grid.cols;
+
+		for(int e = 0; e < NUM_EDGE_DIRECTIONS; e++)
+		{
+			int dx = pixelGrid::dx(gridDirection(e)), dy = pixelGrid::dy(gridDirection(e));
+			if(y + dy < 0) // no row above the first one
+			{
+				continue;
+			}
+
+			int first = std::max(-dx, 0), n = cols - abs(dx); // the pixels whose neighbour in direction e is inside the row
+			const unsigned char* a = current + first * channels;
+			const unsigned char* b = (dy < 0 ? previous : current) + (first + dx) * channels;
+			distanceRow(a, b, channels, &weights[e][(size_t)y * cols + first], n);
+		}
+	}
+
+	void segment(ConcurrentUnionFind* disjointSet, int threads) const // rows are split between the threads
+	{
+		threads = std::min(threads, std::max(grid.rows, 1));
+
+		std::vector<std::thread> workers;
+		for(int b = 0; b < threads; b++)
+		{
+			workers.push_back(std::thread(&MstSegmentation::linkLightestEdges, this, disjointSet, rowBlock(b, threads), rowBlock(b + 1, threads)));
+		}
+		joinAll(&workers);
+	}
+
+	void buildHierarchy(SegmentationHierarchy* hierarchy, int threads) const
+	{
+		threads = std::min(threads, std::max(grid.rows, 1));
+
+		ConcurrentUnionFind disjointSet(hierarchy->size);
+		std::vector<std::atomic<long long>> lightest(hierarchy->size);
+		for(int p = 0; p < hierarchy->size; p++)
+		{
+			lightest[p].store(LLONG_MAX, std::memory_order_relaxed);
+		}
+		std::vector<std::vector<mergeEdge>> merged(threads);
+
+		while(true)
+		{
+			std::vector<std::thread> workers;
+			for(int b = 0; b < threads; b++)
+			{
+				workers.push_back(std::thread(&MstSegmentation::proposeEdges, this, &disjointSet, &lightest, rowBlock(b, threads), rowBlock(b + 1, threads)));
+			}
+			joinAll(&workers);
+
+			for(int b = 0; b < threads; b++)
+			{
+				workers.push_back(std::thread(&MstSegmentation::mergeProposals, this, &disjointSet, &lightest, rowBlock(b, threads), rowBlock(b + 1, threads), &merged[b]));
+			}
+			size_t before = hierarchy->merges.size();
+			for(int b = 0; b < threads; b++)
+			{
+				workers[b].join();
+				hierarchy->merges.insert(hierarchy->merges.end(), merged[b].begin(), merged[b].end());
+				merged[b].clear();
+			}
+
+			if(hierarchy->merges.size() == before)
+			{
+				break;
+			}
+		}
+
+		hierarchy->finish();
+	}
+
+	// other end of the lightest edge of every pixel of rows [begin, end), -1 if it has none; neighbours: (end - begin) * cols ints.
+	// For a band of a larger image (StreamingMstSegmentation) the rows around the band only provide neighbours.
+	void lightestNeighbours(int begin, int end, int* neighbours) const
+	{
+		int first = begin * grid.cols;
+		grid.scan(begin, end, [&](int p, int x, int y)
+		{
+			neighbours[p - first] = lightestNeighbour<true>(p, x, y);
+		}, [&](int p, int x, int y)
+		{
+			neighbours[p - first] = lightestNeighbour<false>(p, x, y);
+		});
+	}
+
+	// dense labels 0 .. count - 1 in raster order of the segments' first pixels from the disjoint-set forest, every thread
+	// takes a block of rows; labels: rows * cols ints. Returns the number of segments.
+	static int labelSegments(const ConcurrentUnionFind& disjointSet, int rows, int cols, int* labels, int threads)
+	{
+		threads = std::max(1, std::min(rows, threads));
+
+		std::vector<int> rowStart(threads + 1); // block of rows of every thread
+		for(int b = 0; b <= threads; b++)
+		{
+			rowStart[b] = (int)((long long)rows * b / threads);
+		}
+
+		std::vector<int> roots(threads, 0);
+		std::vector<std::thread> workers;
+		for(int b = 0; b < threads; b++)
+		{
+			workers.push_back(std::thread(findRoots, &disjointSet, labels, cols, rowStart[b], rowStart[b + 1], &roots[b]));
+		}
+		joinAll(&workers);
+
+		int segmentCount = 0; // labels of a block start after the roots of the blocks above it
+		for(int b = 0; b < threads; b++)
+		{
+			workers.push_back(std::thread(numberRoots, labels, cols, rowStart[b], rowStart[b + 1], segmentCount));
+			segmentCount += roots[b];
+		}
+		joinAll(&workers);
+
+		for(int pass = 0; pass < 2; pass++)
+		{
+			for(int b = 0; b < threads; b++)
+			{
+				workers.push_back(std::thread(resolveLabels, labels, cols, rowStart[b], rowStart[b + 1], pass == 1));
+			}
+			joinAll(&workers);
+		}
+
+		return segmentCount;
+	}
+
+private:
+	int rowBlock(int b, int threads) const
+	{
+		return (int)((long long)grid.rows * b / threads);
+	}
+
+	static void joinAll(std::vector<std::thread>* workers)
+	{
+		for(size_t b = 0; b < workers->size(); b++)
+		{
+			(*workers)[b].join();
+		}
+		workers->clear();
+	}
+
+	long long edgeCount() const
+	{
+		return (long long)grid.size() * NUM_EDGE_DIRECTIONS;
+	}
+
+	long long edgeKey(int owner, int e) const // position of the edge of owner in direction e in the sorted order
+	{
+		return weights[e][owner] * edgeCount() + (long long)owner * NUM_EDGE_DIRECTIONS + e;
+	}
+
+	template <bool interior>
+	int lightestNeighbour(int p, int x, int y) const // other end of the lightest edge of p, -1 if it has none
+	{
+		long long bestKey = LLONG_MAX;
+		int best = -1;
+
+		for(int d = 0; d < pixelGrid::NUM_NEIGHBOURS; d++)
+		{
+			if(!interior && !grid.contains(x + pixelGrid::dx(d), y + pixelGrid::dy(d)))
+			{
+				continue;
+			}
+
+			int q = grid.neighbour(p, d);
+			long long key = ownedEdge(d) != -1 ? edgeKey(p, ownedEdge(d)) : edgeKey(q, ownedEdge(pixelGrid::reverse(d)));
+			if(key < bestKey)
+			{
+				bestKey = key;
+				best = q;
+			}
+		}
+
+		return best;
+	}
+
+	void linkLightestEdges(ConcurrentUnionFind* disjointSet, int begin, int end) const // merge every pixel with the other end of its lightest edge
+	{
+		grid.scan(begin, end, [&](int p, int x, int y)
+		{
+			disjointSet->unite(p, lightestNeighbour<true>(p, x, y));
+		}, [&](int p, int x, int y)
+		{
+			int best = lightestNeighbour<false>(p, x, y);
+			if(best != -1)
+			{
+				disjointSet->unite(p, best);
+			}
+		});
+	}
+
+	// hierarchy: Boruvka rounds until the forest spans every connected part; the first round is segment() above
+
+	static void atomicMin(std::atomic<long long>* target, long long value)
+	{
+		long long old = target->load(std::memory_order_relaxed);
+		while(value < old && !target->compare_exchange_weak(old, value, std::memory_order_relaxed))
+		{
+		}
+	}
+
+	template <bool interior>
+	void proposeOwnedEdges(ConcurrentUnionFind* disjointSet, std::vector<std::atomic<long long>>* lightest, int p, int x, int y) const
+	{
+		for(int e = 0; e < NUM_EDGE_DIRECTIONS; e++)
+		{
+			int d = gridDirection(e);
+			if(!interior && !grid.contains(x + pixelGrid::dx(d), y + pixelGrid::dy(d)))
+			{
+				continue;
+			}
+
+			int a = disjointSet->find(p), b = disjointSet->find(grid.neighbour(p, d));
+			if(a != b)
+			{
+				long long key = edgeKey(p, e);
+				atomicMin(&(*lightest)[a], key);
+				atomicMin(&(*lightest)[b], key);
+			}
+		}
+	}
+
+	void proposeEdges(ConcurrentUnionFind* disjointSet, std::vector<std::atomic<long long>>* lightest, int begin, int end) const // lightest edge leaving every segment
+	{
+		grid.scan(begin, end, [&](int p, int x, int y)
+		{
+			proposeOwnedEdges<true>(disjointSet, lightest, p, x, y);
+		}, [&](int p, int x, int y)
+		{
+			proposeOwnedEdges<false>(disjointSet, lightest, p, x, y);
+		});
+	}
+
+	void mergeProposals(ConcurrentUnionFind* disjointSet, std::vector<std::atomic<long long>>* lightest, int begin, int end, std::vector<mergeEdge>* merged) const
+	{
+		int cols = grid.cols;
+
+		for(int p = begin * cols; p < end * cols; p++)
+		{
+			long long key = (*lightest)[p].load(std::memory_order_relaxed);
+			if(key == LLONG_MAX)
+			{
+				continue;
+			}
+			(*lightest)[p].store(LLONG_MAX, std::memory_order_relaxed);
+
+			mergeEdge e; // decode the key: weight, then owner and direction
+			e.weight = (int)(key / edgeCount());
+			e.sequence = key % edgeCount();
+			int owner = (int)(key % edgeCount() / NUM_EDGE_DIRECTIONS), d = (int)(key % NUM_EDGE_DIRECTIONS);
+			e.u = owner;
+			e.v = grid.neighbour(owner, gridDirection(d));
+			if(disjointSet->unite(e.u, e.v)) // both segments may have proposed the same edge
+			{
+				merged->push_back(e);
+			}
+		}
+	}
+
+	// label map
+
+	static void findRoots(const ConcurrentUnionFind* disjointSet, int* labels, int cols, int begin, int end, int* roots) // root of every pixel as a flat index
+	{
+		for(int p = begin * cols; p < end * cols; p++)
+		{
+			int root = p;
+
+			while(disjointSet->parentOf(root) != root)
+			{
+				root = disjointSet->parentOf(root);
+				if(root < p && root >= begin * cols) // already resolved by this thread: path compression through the label map
+				{
+					root = labels[root];
+					break;
+				}
+			}
+
+			labels[p] = root;
+			if(root == p)
+			{
+				(*roots)++;
+			}
+		}
+	}
+
+	static void numberRoots(int* labels, int cols, int begin, int end, int firstLabel) // roots are replaced by -(label + 1), in raster order
+	{
+		int label = firstLabel;
+
+		for(int p = begin * cols; p < end * cols; p++)
+		{
+			if(labels[p] == p)
+			{
+				labels[p] = -(label++) - 1;
+			}
+		}
+	}
+
+	static void resolveLabels(int* labels, int cols, int begin, int end, bool roots) // first the other pixels look up the label of their root, then the roots are decoded
+	{
+		for(int p = begin * cols; p < end * cols; p++)
+		{
+			int root = labels[p];
+			if(roots && root < 0)
+			{
+				labels[p] = -root - 1;
+			}
+			else if(!roots && root >= 0)
+			{
+				labels[p] = -labels[root] - 1;
+			}
+		}
+	}
+};
+
+#endif
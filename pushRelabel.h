@@ -0,0 +1,535 @@
+#ifndef PUSH_RELABEL_H
+#define PUSH_RELABEL_H
+
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+
+#include "gridGraph.h"
+#include "instrumentation.h"
+
+// Multi-threaded push-relabel max-flow on a GridGraph.
+// Work is done in synchronous rounds over the set of active nodes: a push phase (heights frozen), then a relabel phase that computes
+// new heights into a buffer, then a commit phase. Pushes along an arc are only admissible from the higher end, so the two ends of an arc
+// never write its flow in the same round and the only shared counters are the excesses, which are updated lock-free.
+// Heights are periodically recomputed by a parallel BFS from the sink (and from the source for nodes that cannot reach it) and
+// a gap heuristic lifts nodes that can no longer reach the sink. Excess is returned to the source, so the result is a flow and
+// markCut gives the same cut as the other solvers.
+
+class SpinBarrier // all threads wait until the last one arrives: a bounded spin, a bounded number of yields, then asleep on a condition variable
+{
+public:
+	SpinBarrier(int count) : count(count), spins(count <= (int)std::thread::hardware_concurrency() ? 4096 : 0), waiting(0), generation(0) {}
+
+	void wait()
+	{
+		int gen = generation.load();
+		if(waiting.fetch_add(1) + 1 == count)
+		{
+			waiting.store(0);
+			{
+				std::lock_guard<std::mutex> guard(lock); // a thread between its check and its wait cannot miss the notification
+				generation.fetch_add(1);
+			}
+			released.notify_all();
+			return;
+		}
+
+		for(int k = 0; k < spins; k++) // the rounds are short: with a core per thread the others usually arrive within the spin
+		{
+			if(generation.load() != gen)
+			{
+				return;
+			}
+		}
+		for(int k = 0; k < YIELDS; k++) // with more threads than cores, the core goes straight to a thread that has not arrived
+		{
+			if(generation.load() != gen)
+			{
+				return;
+			}
+			std::this_thread::yield();
+		}
+
+		std::unique_lock<std::mutex> guard(lock);
+		released.wait(guard, [&]{ return generation.load() != gen; });
+	}
+
+private:
+	static const int YIELDS = 64; // a thread that waits longer (a straggler with a long chunk) stops taking turns and sleeps
+
+	int count;
+	int spins; // none if the threads share cores: a spinning thread would hold up the ones it waits for
+	std::atomic<int> waiting;
+	std::atomic<int> generation;
+	std::mutex lock;
+	std::condition_variable released;
+};
+
+template <typename valueType>
+inline void atomicAdd(std::atomic<valueType>* target, valueType value)
+{
+	target->fetch_add(value, std::memory_order_relaxed);
+}
+
+inline void atomicAdd(std::atomic<float>* target, float value) // no fetch_add for floating point before C++20
+{
+	float old = target->load(std::memory_order_relaxed);
+	while(!target->compare_exchange_weak(old, old + value, std::memory_order_relaxed))
+	{
+	}
+}
+
+template <typename capType>
+class ParallelPushRelabel
+{
+public:
+	typedef GridGraph<capType> graphType;
+	typedef typename graphType::traits traits;
+	typedef typename graphType::valueType valueType;
+
+	long long pushes; // number of pushes (saturating or not)
+	long long relabels;
+	int globalRelabels;
+
+	ParallelPushRelabel(graphType* graph, int threads) : pushes(0), relabels(0), globalRelabels(0), graph(graph), threads(std::max(1, threads)),
+		n(graph->size() + 2), excess(graph->size()), height(graph->size()), inNext(graph->size()), countAt(graph->size() + 2), barrier(this->threads)
+	{
+		sourceFlow.assign(graph->size(), 0);
+		kind.assign(graph->size(), NORMAL);
+		local.resize(this->threads);
+	}
+
+	void maxflow()
+	{
+		for(int p = 0; p < graph->size(); p++)
+		{
+			excess[p].store(0);
+			inNext[p].store(false);
+
+			valueType outCapacity = 0;
+			for(int d = 0; d < GridLayout::NUM_ARCS; d++)
+			{
+				outCapacity += graph->capacity[d][p];
+			}
+
+			// a terminal link that can never be saturated (e.g. a seed) makes the pixel part of the terminal itself
+			kind[p] = traits::positive(graph->terminal[p]) && graph->terminal[p] >= outCapacity ? SOURCE_NODE : traits::positive(-graph->terminal[p]) && -graph->terminal[p] >= outCapacity ? SINK_NODE : NORMAL;
+		}
+
+		for(int p = 0; p < graph->size(); p++) // saturate the arcs leaving the source
+		{
+			if(kind[p] == SOURCE_NODE)
+			{
+				for(int d = 0; d < GridLayout::NUM_ARCS; d++)
+				{
+					if(graph->hasArc(p, d) && kind[graph->neighbour(p, d)] != SOURCE_NODE)
+					{
+						valueType amount = graph->residual(p, d);
+						graph->push(p, d, amount);
+						atomicAdd(&excess[graph->neighbour(p, d)], amount);
+					}
+				}
+			}
+			else if(kind[p] == NORMAL && traits::positive(graph->terminal[p]))
+			{
+				sourceFlow[p] = graph->terminal[p];
+				atomicAdd(&excess[p], graph->terminal[p]);
+				graph->terminal[p] = 0;
+			}
+		}
+
+		for(int p = 0; p < graph->size(); p++)
+		{
+			if(kind[p] == NORMAL && traits::positive(excess[p].load()))
+			{
+				active.push_back(p);
+			}
+		}
+
+		done = active.empty();
+		globalRelabel = true; // start with exact heights
+		cursor.store(0);
+
+		std::vector<std::thread> workers;
+		for(int tid = 1; tid < threads; tid++)
+		{
+			workers.push_back(std::thread(&ParallelPushRelabel::worker, this, tid));
+		}
+		worker(0);
+		for(size_t i = 0; i < workers.size(); i++)
+		{
+			workers[i].join();
+		}
+	}
+
+private:
+	struct threadLocal
+	{
+		std::vector<int> next; // nodes that become active in the next round
+		std::vector<int> relabel; // nodes with excess and no admissible arc
+		std::vector<int> newHeight;
+		std::vector<int> frontier;
+		long long pushes, relabels;
+		int lowestEmptied; // lowest height below n that lost a node in this round
+	};
+
+	graphType* graph;
+	int threads;
+	int n; // number of nodes including source and sink; the source sits at height n, the sink at 0
+
+	enum nodeKind
+	{
+		NORMAL = 0, SOURCE_NODE, SINK_NODE // SOURCE_NODE / SINK_NODE pixels are merged with their terminal: fixed height, never active
+	};
+	std::vector<unsigned char> kind;
+
+	std::vector<std::atomic<valueType>> excess;
+	std::vector<std::atomic<int>> height;
+	std::vector<std::atomic<bool>> inNext; // already collected for the next round
+	std::vector<std::atomic<int>> countAt; // number of nodes at each height below n, for the gap heuristic
+	std::vector<valueType> sourceFlow; // flow on the source link of p (residual of the arc back to the source)
+
+	std::vector<int> active;
+	std::vector<int> frontier;
+	std::vector<threadLocal> local;
+	SpinBarrier barrier;
+	std::atomic<int> cursor;
+
+	bool done;
+	bool globalRelabel;
+	int gapLevel;
+	int relabelsSinceGlobal;
+
+	void chunk(int total, int* begin, int* end) // claim the next chunk of [0, total)
+	{
+		const int CHUNK = 256;
+		*begin = cursor.fetch_add(CHUNK);
+		*end = std::min(total, *begin + CHUNK);
+	}
+
+	void worker(int tid)
+	{
+		threadLocal& me = local[tid];
+		me.pushes = me.relabels = 0;
+
+		while(!done)
+		{
+			if(globalRelabel)
+			{
+				globalRelabeling(tid);
+			}
+
+			// push phase: heights are read only
+
+			me.relabel.clear();
+			me.lowestEmptied = n;
+			int size = (int)active.size();
+			for(int begin, end; chunk(size, &begin, &end), begin < size; )
+			{
+				for(int i = begin; i < end; i++)
+				{
+					discharge(active[i], &me);
+				}
+			}
+			barrier.wait();
+
+			// relabel phase: new heights are computed from the heights of the previous round
+
+			me.newHeight.resize(me.relabel.size());
+			for(size_t i = 0; i < me.relabel.size(); i++)
+			{
+				me.newHeight[i] = std::min(minNeighbourHeight(me.relabel[i]) + 1, 2 * n - 1);
+			}
+			barrier.wait();
+
+			for(size_t i = 0; i < me.relabel.size(); i++)
+			{
+				setHeight(me.relabel[i], me.newHeight[i], &me);
+			}
+			me.relabels += (int)me.relabel.size();
+			if(tid == 0)
+			{
+				cursor.store(0);
+			}
+			barrier.wait();
+
+			if(tid == 0)
+			{
+				nextRound();
+			}
+			barrier.wait();
+
+			if(gapLevel < n) // nodes above an empty level cannot reach the sink
+			{
+				int size = graph->size();
+				for(int begin, end; chunk(size, &begin, &end), begin < size; )
+				{
+					for(int p = begin; p < end; p++)
+					{
+						int h = height[p].load(std::memory_order_relaxed);
+						if(h > gapLevel && h < n)
+						{
+							setHeight(p, n + 1, &me);
+						}
+					}
+				}
+				barrier.wait();
+				if(tid == 0)
+				{
+					cursor.store(0);
+				}
+				barrier.wait();
+			}
+		}
+
+		if(tid != 0)
+		{
+			return;
+		}
+
+		for(int i = 0; i < threads; i++)
+		{
+			pushes += local[i].pushes;
+			relabels += local[i].relabels;
+			INSTRUMENT_COUNT(COUNTER_PUSHES, local[i].pushes);
+			INSTRUMENT_COUNT(COUNTER_RELABELS, local[i].relabels);
+		}
+	}
+
+	void setHeight(int p, int h, threadLocal* me)
+	{
+		int old = height[p].load(std::memory_order_relaxed);
+		height[p].store(h, std::memory_order_relaxed);
+		if(old < n && countAt[old].fetch_sub(1) == 1 && old < me->lowestEmptied)
+		{
+			me->lowestEmptied = old;
+		}
+		if(h < n)
+		{
+			countAt[h].fetch_add(1);
+		}
+	}
+
+	void activate(int p, threadLocal* me)
+	{
+		if(kind[p] == NORMAL && !inNext[p].exchange(true))
+		{
+			me->next.push_back(p);
+		}
+	}
+
+	void discharge(int p, threadLocal* me) // push the excess of p along admissible arcs
+	{
+		valueType e = excess[p].load();
+		int h = height[p].load(std::memory_order_relaxed);
+		valueType pushed = 0;
+
+		if(traits::positive(-graph->terminal[p]) && h == 1) // to the sink
+		{
+			valueType amount = std::min(e, -graph->terminal[p]);
+			graph->terminal[p] += amount;
+			pushed += amount;
+			me->pushes++;
+		}
+
+		for(int d = 0; d < GridLayout::NUM_ARCS && pushed < e; d++)
+		{
+			if(!graph->hasArc(p, d))
+			{
+				continue;
+			}
+			int q = graph->neighbour(p, d);
+			if(height[q].load(std::memory_order_relaxed) != h - 1) // check the height first: the arc may be written by q otherwise
+			{
+				continue;
+			}
+			valueType amount = std::min(e - pushed, graph->residual(p, d));
+			if(traits::positive(amount))
+			{
+				graph->push(p, d, amount);
+				atomicAdd(&excess[q], amount);
+				activate(q, me);
+				pushed += amount;
+				me->pushes++;
+			}
+		}
+
+		if(pushed < e && h == n + 1 && traits::positive(sourceFlow[p])) // back to the source
+		{
+			valueType amount = std::min(e - pushed, sourceFlow[p]);
+			sourceFlow[p] -= amount;
+			graph->terminal[p] += amount;
+			pushed += amount;
+			me->pushes++;
+		}
+
+		atomicAdd(&excess[p], -pushed);
+
+		if(pushed < e)
+		{
+			me->relabel.push_back(p);
+			activate(p, me);
+		}
+	}
+
+	int minNeighbourHeight(int p) const
+	{
+		int minHeight = 2 * n - 1;
+
+		if(traits::positive(-graph->terminal[p]))
+		{
+			return 0;
+		}
+		if(traits::positive(sourceFlow[p]))
+		{
+			minHeight = n;
+		}
+		for(int d = 0; d < GridLayout::NUM_ARCS; d++)
+		{
+			if(graph->hasArc(p, d) && graph->unsaturated(p, d))
+			{
+				minHeight = std::min(minHeight, height[graph->neighbour(p, d)].load(std::memory_order_relaxed));
+			}
+		}
+		return minHeight;
+	}
+
+	void nextRound() // serial part between rounds: collect the active nodes, look for gaps
+	{
+		active.clear();
+		gapLevel = n;
+
+		for(int i = 0; i < threads; i++)
+		{
+			for(size_t j = 0; j < local[i].next.size(); j++)
+			{
+				int p = local[i].next[j];
+				inNext[p].store(false, std::memory_order_relaxed);
+				if(traits::positive(excess[p].load(std::memory_order_relaxed)))
+				{
+					active.push_back(p);
+				}
+			}
+			local[i].next.clear();
+
+			relabelsSinceGlobal += (int)local[i].relabel.size();
+
+			int level = local[i].lowestEmptied;
+			if(level > 0 && level < n && countAt[level].load() == 0)
+			{
+				gapLevel = std::min(gapLevel, level);
+			}
+		}
+
+		done = active.empty();
+		globalRelabel = relabelsSinceGlobal >= graph->size() / 2; // exact heights again after about n/2 relabels
+	}
+
+	void globalRelabeling(int tid) // exact heights: BFS from the sink over residual arcs, then from the source for the rest
+	{
+		threadLocal& me = local[tid];
+		int size = graph->size();
+		int lo = (int)((long long)size * tid / threads), hi = (int)((long long)size * (tid + 1) / threads); // static share of the pixels
+		const int unvisited = 2 * n - 1;
+
+		for(int p = lo; p < hi; p++)
+		{
+			height[p].store(unvisited, std::memory_order_relaxed);
+		}
+		for(int h = tid; h < n; h += threads)
+		{
+			countAt[h].store(0, std::memory_order_relaxed);
+		}
+		barrier.wait();
+
+		for(int pass = 0; pass < 2; pass++)
+		{
+			int base = pass == 0 ? 0 : n; // height of the terminal
+
+			me.frontier.clear();
+			for(int p = lo; p < hi; p++)
+			{
+				if(kind[p] == (pass == 0 ? SINK_NODE : SOURCE_NODE))
+				{
+					height[p].store(base, std::memory_order_relaxed);
+					me.frontier.push_back(p);
+				}
+			}
+
+			for(int level = base; ; level++)
+			{
+				barrier.wait();
+				if(tid == 0)
+				{
+					frontier.clear();
+					for(int i = 0; i < threads; i++)
+					{
+						frontier.insert(frontier.end(), local[i].frontier.begin(), local[i].frontier.end());
+					}
+					cursor.store(0);
+				}
+				barrier.wait();
+
+				int frontierSize = (int)frontier.size();
+				if(frontierSize == 0 && level > base)
+				{
+					break;
+				}
+				me.frontier.clear();
+
+				for(int begin, end; chunk(frontierSize, &begin, &end), begin < frontierSize; )
+				{
+					for(int i = begin; i < end; i++)
+					{
+						int q = frontier[i];
+						if(level > 0 && level < n)
+						{
+							countAt[level].fetch_add(1, std::memory_order_relaxed);
+						}
+						for(int d = 0; d < GridLayout::NUM_ARCS; d++) // p can reach q if the arc from p to q has residual capacity
+						{
+							if(graph->hasArc(q, d) && graph->unsaturated(graph->neighbour(q, d), GridLayout::reverse(d)))
+							{
+								claim(graph->neighbour(q, d), level + 1, &me);
+							}
+						}
+					}
+				}
+
+				if(level == base) // pixels with a residual link to the terminal are one step away from it
+				{
+					for(int p = lo; p < hi; p++)
+					{
+						if(kind[p] == NORMAL && (pass == 0 ? traits::positive(-graph->terminal[p]) : traits::positive(sourceFlow[p])))
+						{
+							claim(p, level + 1, &me);
+						}
+					}
+				}
+			}
+		}
+
+		if(tid == 0)
+		{
+			relabelsSinceGlobal = 0;
+			globalRelabels++;
+			cursor.store(0);
+		}
+		barrier.wait();
+	}
+
+	void claim(int p, int h, threadLocal* me) // BFS visit, first thread wins
+	{
+		int unvisited = 2 * n - 1;
+		if(height[p].load(std::memory_order_relaxed) == unvisited && height[p].compare_exchange_strong(unvisited, h, std::memory_order_relaxed))
+		{
+			me->frontier.push_back(p);
+		}
+	}
+};
+
+#endif
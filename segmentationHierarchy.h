@@ -0,0 +1,96 @@
+#ifndef SEGMENTATION_HIERARCHY_H
+#define SEGMENTATION_HIERARCHY_H
+
+#include <vector>
+#include <algorithm>
+
+#include "concurrentUnionFind.h"
+
+// Merge hierarchy of a segmentation: the edges of a minimum spanning forest of the pixel graph in the order they merge
+// (ascending weight, ties in scan order). Cutting it after the first m merges gives the segmentation with size - m segments,
+// and the segmentation at a weight threshold merges every edge up to that weight, so any threshold or segment count
+// is extracted in one pass over the merges without touching the image or sorting again. The merges are ordered by a radix sort,
+// linear in their number like the bucketed edge order of the segmentation itself.
+
+struct mergeEdge
+{
+	int u, v; // pixel indices
+	int weight;
+	long long sequence; // position of the edge in scan order (owner pixel, then direction): breaks ties between equal weights
+};
+
+class SegmentationHierarchy
+{
+public:
+	static const int NUM_WEIGHTS = 256;
+	static const int SEQUENCE_BITS = 16; // sequence digit of a counting sort pass
+
+	int size; // number of pixels
+	std::vector<mergeEdge> merges;
+
+	SegmentationHierarchy(int size) : size(size) {}
+
+	void finish() // order the merges once they are all added: stable counting sorts on the sequence digits, lowest first, then the weight
+	{
+		long long largest = 0;
+		for(size_t k = 0; k < merges.size(); k++)
+		{
+			largest = std::max(largest, merges[k].sequence);
+		}
+
+		std::vector<mergeEdge> sorted(merges.size());
+		std::vector<int> count;
+		int shift = 0;
+		do
+		{
+			countingSort([shift](const mergeEdge& e) { return (int)(e.sequence >> shift) & ((1 << SEQUENCE_BITS) - 1); }, 1 << SEQUENCE_BITS, &sorted, &count);
+			shift += SEQUENCE_BITS;
+		}
+		while((largest >> shift) > 0);
+		countingSort([](const mergeEdge& e) { return e.weight; }, NUM_WEIGHTS, &sorted, &count);
+
+		mergesUpTo.assign(count.begin(), count.begin() + NUM_WEIGHTS); // the end of every weight's bucket
+	}
+
+	int mergesAtThreshold(int threshold) const // number of merges with weight <= threshold
+	{
+		return threshold < 0 ? 0 : mergesUpTo[std::min(threshold, NUM_WEIGHTS - 1)];
+	}
+
+	int mergesForSegments(int segments) const
+	{
+		return std::max(0, std::min((int)merges.size(), size - segments));
+	}
+
+	void cut(int mergeCount, ConcurrentUnionFind* forest) const // forest: fresh sets, one per pixel
+	{
+		for(int k = 0; k < mergeCount; k++)
+		{
+			forest->unite(merges[k].u, merges[k].v);
+		}
+	}
+
+private:
+	std::vector<int> mergesUpTo; // mergesUpTo[w]: number of merges with weight <= w
+
+	template <typename digitFunction>
+	void countingSort(digitFunction digit, int buckets, std::vector<mergeEdge>* sorted, std::vector<int>* count) // stable; count[b]: end of bucket b
+	{
+		count->assign(buckets + 1, 0);
+		for(size_t k = 0; k < merges.size(); k++)
+		{
+			(*count)[digit(merges[k]) + 1]++;
+		}
+		for(int b = 0; b < buckets; b++) // count[b]: first position of bucket b
+		{
+			(*count)[b + 1] += (*count)[b];
+		}
+		for(size_t k = 0; k < merges.size(); k++)
+		{
+			(*sorted)[(*count)[digit(merges[k])]++] = merges[k];
+		}
+		merges.swap(*sorted);
+	}
+};
+
+#endif
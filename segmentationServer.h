@@ -0,0 +1,407 @@
+#ifndef SEGMENTATION_SERVER_H
+#define SEGMENTATION_SERVER_H
+
+#include <vector>
+#include <string>
+#include <sstream>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <system_error>
+#include <algorithm>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "batchPipeline.h"
+#include "sidecarSeeds.h"
+
+// Resident server mode: the program listens on a Unix domain socket and segments one image per request on a pool of worker
+// threads that stay up between requests. Every worker keeps its own state (decoded image, graph, label buffers) from one request
+// to the next, so a stream of images of the same size allocates nothing after the first one, and no request pays for the
+// process start.
+//
+// A request is one line of space separated words, optionally followed by the bytes of an encoded image:
+//
+//	path=<image file> | bytes=<n>, then n bytes of PNG, JPEG, PNM, ...
+//	seed=<x>,<y>,<label> (any number, label 1 for foreground and -1 for background)
+//	the parameters of the program (e.g. solver=2, threshold=128, w=lab), or "shutdown" to stop the server
+//
+// The answer is one line, "ok rows=<r> cols=<c> type=mask|labels count=<n> bytes=<b> wait=<ms> decode=<ms> segment=<ms>
+// total=<ms>" followed by b bytes of the result, one byte per pixel for a mask or a 32 bit label (host byte order) per pixel for
+// a label map, row by row; or "error <message>". A connection can send any number of requests, each answered in order.
+
+struct serverRequest
+{
+	std::string path; // image file, or empty if the image is in bytes
+	std::vector<unsigned char> bytes; // encoded image
+	std::vector<seedPoint> seeds;
+	std::vector<std::string> words; // the other words of the request line
+
+	bool has(const std::string& word) const
+	{
+		return std::find(words.begin(), words.end(), word) != words.end();
+	}
+
+	std::string value(const std::string& key, const std::string& fallback) const // of "key=value"
+	{
+		for(size_t k = 0; k < words.size(); k++)
+		{
+			if(words[k].size() > key.size() && words[k].compare(0, key.size(), key) == 0 && words[k][key.size()] == '=')
+			{
+				return words[k].substr(key.size() + 1);
+			}
+		}
+		return fallback;
+	}
+};
+
+struct serverResponse
+{
+	std::string error; // empty on success
+	std::string type; // "mask" or "labels"
+	int rows, cols;
+	int count; // components, segments or 2 for a mask
+	std::vector<unsigned char> data; // kept by the worker: the buffer is reused by its next request
+};
+
+class SegmentationServer
+{
+public:
+	// workerState: default constructible, one per worker for the whole run. decode(request, state*, error*) returns false with a
+	// message; segment(request, state*, response*) fills the response. Returns when a client sends "shutdown"; false if the
+	// socket cannot be set up.
+	template <typename workerState, typename decodeFunction, typename segmentFunction>
+	static bool run(const std::string& socketPath, int threads, decodeFunction decode, segmentFunction segment)
+	{
+		int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+		struct sockaddr_un address;
+		memset(&address, 0, sizeof(address));
+		address.sun_family = AF_UNIX;
+		if(listener < 0 || socketPath.size() >= sizeof(address.sun_path))
+		{
+			return false;
+		}
+		strcpy(address.sun_path, socketPath.c_str());
+		unlink(socketPath.c_str()); // left over by a server that was killed
+		if(bind(listener, (struct sockaddr*)&address, sizeof(address)) != 0 || listen(listener, 64) != 0)
+		{
+			close(listener);
+			return false;
+		}
+		signal(SIGPIPE, SIG_IGN); // a client that goes away is seen as a failed write
+
+		threads = std::max(threads, 1);
+		BoundedQueue<task*> queue(threads);
+		queue.addProducer();
+
+		std::vector<std::thread> workers;
+		for(int k = 0; k < threads; k++)
+		{
+			workers.push_back(std::thread([&]()
+			{
+				workerState state;
+				serverResponse response;
+				task* current;
+				while(queue.pop(&current))
+				{
+					clock::time_point start = clock::now();
+					current->wait = milliseconds(current->received, start);
+					response.error.clear();
+					if(decode(current->request, &state, &response.error))
+					{
+						clock::time_point decoded = clock::now();
+						current->decode = milliseconds(start, decoded);
+						segment(current->request, &state, &response);
+						current->segment = milliseconds(decoded, clock::now());
+					}
+					else if(response.error.empty())
+					{
+						response.error = "could not decode the image";
+					}
+
+					std::unique_lock<std::mutex> guard(current->lock);
+					current->answer(response);
+					current->done = true;
+					current->finished.notify_all();
+				}
+			}));
+		}
+
+		std::mutex clientLock;
+		std::condition_variable connectionsDone;
+		std::vector<int> clients; // open connections; each is closed by its own thread when it ends
+		int connections = 0;
+		bool stopping = false;
+
+		while(true)
+		{
+			int client = accept(listener, NULL, NULL);
+			if(client < 0)
+			{
+				if(errno == EINTR || errno == ECONNABORTED)
+				{
+					continue;
+				}
+				if(errno == EMFILE || errno == ENFILE || errno == ENOMEM || errno == ENOBUFS) // out of descriptors or memory: retry as connections end
+				{
+					std::this_thread::sleep_for(std::chrono::milliseconds(100));
+					std::lock_guard<std::mutex> guard(clientLock);
+					if(!stopping)
+					{
+						continue;
+					}
+				}
+				break; // the listener was shut down
+			}
+
+			std::lock_guard<std::mutex> guard(clientLock);
+			if(stopping)
+			{
+				close(client);
+				break;
+			}
+			try
+			{
+				std::thread([&, client]()
+				{
+					bool stop = serve(client, &queue);
+
+					std::lock_guard<std::mutex> guard(clientLock);
+					if(stop)
+					{
+						stopping = true;
+						shutdown(listener, SHUT_RDWR); // wakes accept()
+					}
+					clients.erase(std::find(clients.begin(), clients.end(), client));
+					close(client);
+					connections--;
+					connectionsDone.notify_all(); // under the lock: run() cannot return before this thread is done with its variables
+				}).detach();
+			}
+			catch(const std::system_error&) // no thread for this connection: drop it, the others go on
+			{
+				close(client);
+				continue;
+			}
+			clients.push_back(client); // the thread waits for clientLock before it looks at the list
+			connections++;
+		}
+
+		{
+			std::unique_lock<std::mutex> guard(clientLock);
+			stopping = true;
+			for(size_t k = 0; k < clients.size(); k++)
+			{
+				shutdown(clients[k], SHUT_RDWR); // idle connections stop waiting for their next request
+			}
+			connectionsDone.wait(guard, [&]{ return connections == 0; });
+		}
+		queue.removeProducer();
+		for(size_t k = 0; k < workers.size(); k++)
+		{
+			workers[k].join();
+		}
+
+		close(listener);
+		unlink(socketPath.c_str());
+		return true;
+	}
+
+private:
+	typedef std::chrono::steady_clock clock;
+
+	struct task // one request on its way through the pool
+	{
+		serverRequest request;
+		clock::time_point received;
+		double wait, decode, segment;
+		std::string header; // the answer, written by the worker
+		std::vector<unsigned char> data;
+		bool done;
+		std::mutex lock;
+		std::condition_variable finished;
+
+		task() : wait(0), decode(0), segment(0), done(false) {}
+
+		void answer(const serverResponse& response)
+		{
+			std::ostringstream line;
+			if(!response.error.empty())
+			{
+				line << "error " << response.error << "\n";
+				header = line.str();
+				return;
+			}
+			line << "ok rows=" << response.rows << " cols=" << response.cols << " type=" << response.type << " count=" << response.count;
+			line << " bytes=" << response.data.size() << " wait=" << wait << " decode=" << decode << " segment=" << segment;
+			line << " total=" << milliseconds(received, clock::now()) << "\n";
+			header = line.str();
+			data.assign(response.data.begin(), response.data.end()); // the connection's buffer, reused for its next request
+		}
+	};
+
+	static double milliseconds(clock::time_point begin, clock::time_point end)
+	{
+		return std::chrono::duration<double, std::milli>(end - begin).count();
+	}
+
+	static bool serve(int client, BoundedQueue<task*>* queue) // requests of one connection until it closes; true for "shutdown"
+	{
+		std::string pending; // read past the end of the last request line
+		task current;
+
+		while(true)
+		{
+			std::string line;
+			if(!readLine(client, &pending, &line))
+			{
+				return false;
+			}
+			current.received = clock::now();
+
+			serverRequest& request = current.request;
+			request.path.clear();
+			request.seeds.clear();
+			request.words.clear();
+			size_t size = 0;
+			std::istringstream words(line);
+			std::string word;
+			while(words >> word)
+			{
+				if(word.compare(0, 5, "path=") == 0)
+				{
+					request.path = word.substr(5);
+				}
+				else if(word.compare(0, 6, "bytes=") == 0)
+				{
+					size = (size_t)strtoull(word.c_str() + 6, NULL, 10);
+				}
+				else if(word.compare(0, 5, "seed=") == 0)
+				{
+					seedPoint seed = {0, 0, 1};
+					if(sscanf(word.c_str() + 5, "%d,%d,%d", &seed.x, &seed.y, &seed.label) >= 2)
+					{
+						request.seeds.push_back(seed);
+					}
+				}
+				else if(word == "shutdown")
+				{
+					writeAll(client, "ok shutdown\n", 12);
+					return true;
+				}
+				else
+				{
+					request.words.push_back(word);
+				}
+			}
+
+			request.bytes.resize(size);
+			size_t have = std::min(size, pending.size());
+			std::copy(pending.begin(), pending.begin() + have, request.bytes.begin());
+			pending.erase(0, have);
+			if(have < size && !readAll(client, request.bytes.data() + have, size - have))
+			{
+				return false;
+			}
+
+			if(request.path.empty() && request.bytes.empty())
+			{
+				std::string error = "error expected path=<image file> or bytes=<n>\n";
+				if(!writeAll(client, error.data(), error.size()))
+				{
+					return false;
+				}
+				continue;
+			}
+
+			current.done = false;
+			queue->push(&current);
+			{
+				std::unique_lock<std::mutex> guard(current.lock);
+				current.finished.wait(guard, [&]{ return current.done; });
+			}
+
+			if(!writeAll(client, current.header.data(), current.header.size()) || (current.header[0] == 'o' && !writeAll(client, current.data.data(), current.data.size())))
+			{
+				return false;
+			}
+		}
+	}
+
+	static bool readLine(int client, std::string* pending, std::string* line)
+	{
+		while(true)
+		{
+			size_t end = pending->find('\n');
+			if(end != std::string::npos)
+			{
+				*line = pending->substr(0, end);
+				pending->erase(0, end + 1);
+				return true;
+			}
+			if(pending->size() > 1 << 20) // no request line is that long
+			{
+				return false;
+			}
+
+			char buffer[4096];
+			ssize_t got = recv(client, buffer, sizeof(buffer), 0);
+			if(got < 0 && errno == EINTR)
+			{
+				continue;
+			}
+			if(got <= 0)
+			{
+				return false;
+			}
+			pending->append(buffer, got);
+		}
+	}
+
+	static bool readAll(int client, unsigned char* data, size_t size)
+	{
+		while(size > 0)
+		{
+			ssize_t got = recv(client, data, size, 0);
+			if(got < 0 && errno == EINTR)
+			{
+				continue;
+			}
+			if(got <= 0)
+			{
+				return false;
+			}
+			data += got;
+			size -= got;
+		}
+		return true;
+	}
+
+	static bool writeAll(int client, const void* data, size_t size)
+	{
+		const char* bytes = (const char*)data;
+		while(size > 0)
+		{
+			ssize_t sent = send(client, bytes, size, 0);
+			if(sent < 0 && errno == EINTR)
+			{
+				continue;
+			}
+			if(sent <= 0)
+			{
+				return false;
+			}
+			bytes += sent;
+			size -= sent;
+		}
+		return true;
+	}
+};
+
+#endif
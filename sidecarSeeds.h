@@ -0,0 +1,125 @@
+#ifndef SIDECAR_SEEDS_H
+#define SIDECAR_SEEDS_H
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <stdlib.h>
+
+// Seeds of an image in batch mode, read from "<image path>.seeds.csv" or, if there is none, "<image path>.seeds.json".
+//
+//	CSV: one seed per line, "x,y" or "x,y,label" (commas or spaces); label 1 (default) for foreground, -1 for background; # starts a comment
+//	JSON: {"foreground": [[x, y], ...], "background": [[x, y], ...]} or {"seeds": [[x, y], ...]} for seeds without a side
+//
+// Seeds keep the order of the file, which decides ties between regions in ccl.
+
+struct seedPoint
+{
+	int x, y;
+	int label; // > 0: foreground, < 0: background
+};
+
+class SidecarSeeds
+{
+public:
+	static bool read(const std::string& imagePath, std::vector<seedPoint>* seeds) // false if there is no sidecar file
+	{
+		std::ifstream csv((imagePath + ".seeds.csv").c_str());
+		if(csv)
+		{
+			readCsv(csv, seeds);
+			return true;
+		}
+
+		std::ifstream json((imagePath + ".seeds.json").c_str());
+		if(json)
+		{
+			std::stringstream text;
+			text << json.rdbuf();
+			readJson(text.str(), seeds);
+			return true;
+		}
+
+		return false;
+	}
+
+private:
+	static void readCsv(std::istream& in, std::vector<seedPoint>* seeds)
+	{
+		std::string line;
+		while(std::getline(in, line))
+		{
+			line = line.substr(0, line.find('#'));
+			for(size_t k = 0; k < line.size(); k++)
+			{
+				if(line[k] == ',')
+				{
+					line[k] = ' ';
+				}
+			}
+
+			std::istringstream fields(line);
+			seedPoint seed;
+			if(!(fields >> seed.x >> seed.y)) // blank line or header
+			{
+				continue;
+			}
+			if(!(fields >> seed.label))
+			{
+				seed.label = 1;
+			}
+			seeds->push_back(seed);
+		}
+	}
+
+	static void readJson(const std::string& text, std::vector<seedPoint>* seeds) // only the structure described above, no general JSON
+	{
+		int label = 1;
+		int depth = 0, listDepth = -1; // bracket depth, and the depth of the current list of points
+		std::vector<int> numbers;
+
+		for(size_t k = 0; k < text.size(); k++)
+		{
+			char c = text[k];
+			if(c == '"')
+			{
+				size_t end = text.find('"', k + 1);
+				std::string key = text.substr(k + 1, end - k - 1);
+				label = key == "background" ? -1 : 1;
+				k = end == std::string::npos ? text.size() : end;
+			}
+			else if(c == '[')
+			{
+				if(listDepth == -1)
+				{
+					listDepth = depth;
+				}
+				depth++;
+				numbers.clear();
+			}
+			else if(c == ']')
+			{
+				depth--;
+				if(depth == listDepth)
+				{
+					listDepth = -1;
+				}
+				else if(numbers.size() >= 2)
+				{
+					seedPoint seed = {numbers[0], numbers[1], label};
+					seeds->push_back(seed);
+				}
+				numbers.clear();
+			}
+			else if(c == '-' || (c >= '0' && c <= '9'))
+			{
+				char* end;
+				numbers.push_back((int)strtol(text.c_str() + k, &end, 10));
+				k = end - text.c_str() - 1;
+			}
+		}
+	}
+};
+
+#endif
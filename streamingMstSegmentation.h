@@ -0,0 +1,277 @@
+#ifndef STREAMING_MST_SEGMENTATION_H
+#define STREAMING_MST_SEGMENTATION_H
+
+#include <vector>
+#include <memory>
+#include <thread>
+#include <utility>
+#include <algorithm>
+#include <stdio.h>
+
+#include "mstSegmentation.h"
+#include "concurrentUnionFind.h"
+
+// MstSegmentation::segment() for images that do not fit in memory: the image is read in bands of rows, top to bottom. A band is
+// weighed together with the row above and the row below it, so every pixel of the band sees all of its neighbours and finds the same
+// lightest edge as in the whole image, and the lightest edges are linked in a union-find over the band only.
+// Between two bands only a summary of the seam is kept: the segment of every pixel of the last row read (as the provisional number of
+// its root), and the lightest edges that go down from that row into the next band, which are linked when the next band is read.
+// The criterion needs no other statistics of a segment.
+//
+// Segments are numbered when their first pixel is met, in raster order, and the numbers of every band are spilled to a temporary
+// file. Two numbered segments can still meet at a later seam (a U shape): the larger number is merged into the smaller one and the
+// pair is kept. writeLabels() reads the bands back and turns the numbers into the labels of MstSegmentation::labelSegments() (dense,
+// in raster order of the segments' first pixels). Memory is a few ints per pixel of a band, one row of seam summary and two ints per
+// merge at a seam, whatever the image area.
+
+class StreamingMstSegmentation
+{
+public:
+	long long seamMerges; // pairs of segments that were numbered apart and met at a later seam
+
+	StreamingMstSegmentation(int rows, int cols, int channels, int bandRows, int threads) : seamMerges(0), rows(rows), cols(cols), channels(channels),
+		bandRows(std::max(bandRows, 1)), threads(std::max(threads, 1)), numbered(0), spill(tmpfile()) {}
+
+	~StreamingMstSegmentation()
+	{
+		if(spill != NULL)
+		{
+			fclose(spill);
+		}
+	}
+
+	// readRow(y, row) stores row y as cols pixels of channels interleaved bytes (see MstSegmentation::weightRow) and is called by several
+	// threads at once; rowsDone(y) tells that the rows above y are not read again. False if the temporary file cannot be written.
+	template <typename readFunction, typename doneFunction>
+	bool segment(readFunction readRow, doneFunction rowsDone)
+	{
+		if(spill == NULL)
+		{
+			return false;
+		}
+
+		std::vector<int> seamSlot(cols); // seam segment of every pixel of the last row read
+		std::vector<int> seamNumber, seamFirst; // number and first column of every seam segment
+		std::vector<int> seamEdge(cols, -1), nextSeamEdge(cols); // column of the lightest neighbour of a seam pixel in the next band, or -1
+		std::unique_ptr<MstSegmentation> band;
+		std::vector<int> neighbours, number, slot, ids;
+
+		for(int y0 = 0; y0 < rows; y0 += bandRows)
+		{
+			int y1 = std::min(y0 + bandRows, rows);
+			int first = y0 > 0 ? 1 : 0, last = first + y1 - y0; // local rows of the band; local row 0 is the seam above it, last the row below it
+			int localRows = last + (y1 < rows ? 1 : 0);
+			if(!band || band->grid.rows != localRows)
+			{
+				band.reset(new MstSegmentation(localRows, cols));
+			}
+
+			// weights of the edges the band and the row below it own, then the lightest edge of every pixel of the band
+			inParallel(first, localRows, [&](int begin, int end)
+			{
+				weighRows(band.get(), y0 - first, begin, end, &readRow);
+			});
+			rowsDone(y1 - 1);
+
+			ConcurrentUnionFind linked(last * cols);
+			neighbours.resize((size_t)(y1 - y0) * cols);
+			std::fill(nextSeamEdge.begin(), nextSeamEdge.end(), -1);
+			inParallel(first, last, [&](int begin, int end)
+			{
+				int* neighbour = &neighbours[(size_t)(begin - first) * cols];
+				band->lightestNeighbours(begin, end, neighbour);
+				for(int p = begin * cols; p < end * cols; p++, neighbour++)
+				{
+					if(*neighbour >= last * cols) // into the next band: linked there
+					{
+						nextSeamEdge[p % cols] = *neighbour - last * cols;
+					}
+					else if(*neighbour != -1)
+					{
+						linked.unite(p, *neighbour);
+					}
+				}
+			});
+
+			if(first == 1) // the seam: its pixels as they were linked above, and its lightest edges into this band
+			{
+				for(int x = 0; x < cols; x++)
+				{
+					linked.unite(x, seamFirst[seamSlot[x]]);
+					if(seamEdge[x] != -1)
+					{
+						linked.unite(x, cols + seamEdge[x]);
+					}
+				}
+			}
+			seamEdge.swap(nextSeamEdge);
+
+			// numbers: a segment that reaches the seam keeps the smallest number it had there, the others are numbered in raster order
+			number.assign((size_t)last * cols, -1);
+			for(size_t s = 0; s < seamNumber.size(); s++)
+			{
+				int& root = number[linked.find(seamFirst[s])];
+				if(root == -1)
+				{
+					root = seamNumber[s];
+				}
+				else
+				{
+					merges.push_back(std::make_pair(std::max(root, seamNumber[s]), std::min(root, seamNumber[s])));
+					root = std::min(root, seamNumber[s]);
+					seamMerges++;
+				}
+			}
+
+			ids.resize((size_t)(y1 - y0) * cols);
+			for(int p = first * cols; p < last * cols; p++)
+			{
+				int& root = number[linked.find(p)];
+				if(root == -1)
+				{
+					root = numbered++;
+				}
+				ids[p - first * cols] = root;
+			}
+			if(fwrite(&ids[0], sizeof(int), ids.size(), spill) != ids.size())
+			{
+				return false;
+			}
+
+			// summary of the seam below the band: its segments in the order of their first pixels
+			slot.assign((size_t)last * cols, -1);
+			seamNumber.clear();
+			seamFirst.clear();
+			for(int x = 0; x < cols; x++)
+			{
+				int root = linked.find((last - 1) * cols + x);
+				if(slot[root] == -1)
+				{
+					slot[root] = (int)seamNumber.size();
+					seamNumber.push_back(number[root]);
+					seamFirst.push_back(x);
+				}
+				seamSlot[x] = slot[root];
+			}
+		}
+
+		resolveMerges();
+		return true;
+	}
+
+	int segmentCount() const // after segment()
+	{
+		return numbered - (int)merges.size();
+	}
+
+	// writeRow(y, labels) with the cols labels of row y, for y = 0 .. rows - 1 in order. False if the temporary file cannot be read.
+	template <typename writeFunction>
+	bool writeLabels(writeFunction writeRow)
+	{
+		rewind(spill);
+
+		std::vector<int> row(cols);
+		for(int y = 0; y < rows; y++)
+		{
+			if(fread(&row[0], sizeof(int), cols, spill) != (size_t)cols)
+			{
+				return false;
+			}
+
+			int id = -1, label = -1; // neighbouring pixels mostly share a segment
+			for(int x = 0; x < cols; x++)
+			{
+				if(row[x] != id)
+				{
+					id = row[x];
+					label = labelOf(id);
+				}
+				row[x] = label;
+			}
+			writeRow(y, (const int*)&row[0]);
+		}
+		return true;
+	}
+
+private:
+	int rows, cols, channels;
+	int bandRows, threads;
+	int numbered; // provisional numbers handed out
+	FILE* spill; // provisional numbers of all pixels, in raster order
+	std::vector<std::pair<int, int>> merges; // (merged number, the smaller number it joined), sorted and resolved to (merged number, label)
+
+	template <typename function>
+	void inParallel(int begin, int end, function f) const // f(first, last) on blocks of the local rows [begin, end)
+	{
+		int blocks = std::max(1, std::min(threads, end - begin));
+		std::vector<std::thread> workers;
+		for(int b = 0; b < blocks; b++)
+		{
+			workers.push_back(std::thread(f, begin + (int)((long long)(end - begin) * b / blocks), begin + (int)((long long)(end - begin) * (b + 1) / blocks)));
+		}
+		for(int b = 0; b < blocks; b++)
+		{
+			workers[b].join();
+		}
+	}
+
+	template <typename readFunction>
+	void weighRows(MstSegmentation* band, int offset, int begin, int end, readFunction* readRow) const // local rows [begin, end) of image rows offset + row
+	{
+		std::vector<unsigned char> previous(channels * cols), current(channels * cols);
+
+		if(begin > 0)
+		{
+			(*readRow)(offset + begin - 1, &previous);
+		}
+
+		for(int r = begin; r < end; r++)
+		{
+			(*readRow)(offset + r, &current);
+			band->weightRow(r, current.data(), previous.data(), channels);
+
+			current.swap(previous);
+		}
+	}
+
+	std::vector<std::pair<int, int>>::const_iterator findMerge(int id) const
+	{
+		return std::lower_bound(merges.begin(), merges.end(), std::make_pair(id, -1));
+	}
+
+	void resolveMerges() // every merged number to the label of the root its chain of merges ends at
+	{
+		std::sort(merges.begin(), merges.end());
+
+		for(size_t k = 0; k < merges.size(); k++) // the number joined is smaller, so its own merge is resolved already
+		{
+			std::vector<std::pair<int, int>>::const_iterator joined = findMerge(merges[k].second);
+			if(joined != merges.end() && joined->first == merges[k].second)
+			{
+				merges[k].second = joined->second;
+			}
+		}
+
+		std::vector<int> labels(merges.size());
+		for(size_t k = 0; k < merges.size(); k++)
+		{
+			labels[k] = labelOf(merges[k].second);
+		}
+		for(size_t k = 0; k < merges.size(); k++)
+		{
+			merges[k].second = labels[k];
+		}
+	}
+
+	int labelOf(int id) const // roots are labelled in the order of their numbers, skipping the numbers merged away; merged numbers once resolved
+	{
+		std::vector<std::pair<int, int>>::const_iterator merged = findMerge(id);
+		if(merged != merges.end() && merged->first == id)
+		{
+			return merged->second;
+		}
+		return id - (int)(merged - merges.begin());
+	}
+};
+
+#endif
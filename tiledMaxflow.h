@@ -0,0 +1,586 @@
+#ifndef TILED_MAXFLOW_H
+#define TILED_MAXFLOW_H
+
+#include <vector>
+#include <queue>
+#include <algorithm>
+#include <functional>
+#include <stdio.h>
+#include <sys/types.h>
+
+#include "gridGraph.h"
+#include "mappedImage.h"
+
+// Out-of-core max-flow for grids that do not fit in memory: region push-relabel over square tiles
+// ("A Scalable Graph-Cut Algorithm for N-D Grids", Delong and Boykov, CVPR 2008).
+// Each tile keeps its own half of the arcs that cross its border. A tile is discharged on its own with the heights of the
+// neighbouring border pixels frozen; flow pushed across the border is queued in the neighbour's inbox and applied when the
+// neighbour is discharged next. Heights are recomputed after every sweep by a tile-wise BFS from the sink until the border
+// distances stop changing, which also detects the end: no tile has a node with excess that can still reach the sink.
+// Only "residentTiles" tiles are in memory at a time; the others are written to one temporary file. The border heights and
+// inboxes (proportional to the tile perimeters) always stay in memory.
+// The result is a maximum preflow: the source side of the cut is the set of pixels that cannot reach the sink.
+// Heights and the node count are 64 bit, so images above 2^31 pixels work; indices inside a tile stay int (tiles are at most
+// 2^15 pixels wide).
+// If the temporary file cannot be created, written or read back whole, build(), setSeed(), maxflow() and writeMask() return false.
+
+template <typename capType>
+class TiledMaxflow
+{
+public:
+	typedef capacityTraits<capType> traits;
+	typedef typename traits::flowType flowType;
+	typedef typename traits::valueType valueType;
+
+	int sweeps; // region discharge sweeps over all tiles
+	int loads; // tiles read back from disk
+
+	TiledMaxflow(int rows, int cols, int tileSize, int residentTiles) : sweeps(0), loads(0), rows(rows), cols(cols),
+		tileSize(std::min(std::max(tileSize, 1), 1 << 15)), residentTiles(std::max(residentTiles, 1)), resident(0), clock(0), failed(false)
+	{
+		n = (long long)rows * cols + 2;
+		tilesX = (cols + this->tileSize - 1) / this->tileSize;
+		tilesY = (rows + this->tileSize - 1) / this->tileSize;
+		tiles.resize(tilesX * tilesY);
+
+		for(int ty = 0; ty < tilesY; ty++)
+		{
+			for(int tx = 0; tx < tilesX; tx++)
+			{
+				tile& t = tiles[ty * tilesX + tx];
+				t.x0 = tx * this->tileSize;
+				t.y0 = ty * this->tileSize;
+				t.w = std::min(this->tileSize, cols - t.x0);
+				t.h = std::min(this->tileSize, rows - t.y0);
+				t.isResident = t.onDisk = t.active = t.pending = false;
+				t.lastUse = 0;
+				t.borderHeight.assign(2 * t.w + 2 * t.h, n);
+				t.inboxExcess.assign(2 * t.w + 2 * t.h, 0);
+				for(int d = 0; d < GridLayout::NUM_ARCS; d++)
+				{
+					t.inboxFlow[d].assign(2 * t.w + 2 * t.h, 0);
+				}
+			}
+		}
+
+		size_t pixelBytes = GridLayout::NUM_ARCS * (sizeof(capType) + sizeof(flowType)) + 2 * sizeof(valueType) + sizeof(long long);
+		slotBytes = (off_t)this->tileSize * this->tileSize * pixelBytes;
+		spill = tmpfile();
+	}
+
+	~TiledMaxflow()
+	{
+		if(spill != NULL)
+		{
+			fclose(spill);
+		}
+	}
+
+	bool build(const WeightTable<capType>& table, const unsigned char* gray, size_t step) // arc capacities from an 8 bit gray image, tile by tile
+	{
+		for(int i = 0; i < (int)tiles.size(); i++)
+		{
+			tile& t = tiles[i];
+			if(!load(i))
+			{
+				return false;
+			}
+
+			for(int ly = 0; ly < t.h; ly++)
+			{
+				for(int lx = 0; lx < t.w; lx++)
+				{
+					int x = t.x0 + lx, y = t.y0 + ly;
+					int cur = gray[y * step + x];
+
+					for(int d = 0; d < GridLayout::NUM_ARCS; d++)
+					{
+						int nx = x + GridLayout::dx(d), ny = y + GridLayout::dy(d);
+						if(nx >= 0 && nx < cols && ny >= 0 && ny < rows)
+						{
+							t.capacity[d][ly * t.w + lx] = table(cur, gray[ny * step + nx]);
+						}
+					}
+				}
+			}
+		}
+		return true;
+	}
+
+	bool setSeed(int x, int y, int label) // label > 0: foreground seed, < 0: background seed; before maxflow()
+	{
+		int i = tileOf(x, y);
+		if(!load(i))
+		{
+			return false;
+		}
+		tiles[i].terminal[(y - tiles[i].y0) * tiles[i].w + x - tiles[i].x0] = label > 0 ? traits::infinity() : -traits::infinity();
+		return true;
+	}
+
+	bool maxflow()
+	{
+		for(int i = 0; i < (int)tiles.size(); i++) // saturate the source links
+		{
+			tile& t = tiles[i];
+			if(!load(i))
+			{
+				return false;
+			}
+
+			for(int p = 0; p < t.w * t.h; p++)
+			{
+				if(traits::positive(t.terminal[p]))
+				{
+					valueType outCapacity = 0;
+					for(int d = 0; d < GridLayout::NUM_ARCS; d++)
+					{
+						outCapacity += t.capacity[d][p];
+					}
+					t.excess[p] = std::min(t.terminal[p], outCapacity + 1); // more can never leave p
+					t.terminal[p] = 0;
+				}
+			}
+		}
+
+		globalRelabel();
+
+		while(!failed)
+		{
+			bool discharged = false;
+			for(int i = 0; i < (int)tiles.size() && !failed; i++)
+			{
+				if(tiles[i].active || tiles[i].pending)
+				{
+					discharge(i);
+					discharged = true;
+				}
+			}
+			if(!discharged)
+			{
+				break;
+			}
+			sweeps++;
+			globalRelabel();
+		}
+		return !failed;
+	}
+
+	bool writeMask(const char* path) // binary PGM, 255 on the source side of the cut; written tile by tile into the mapped file
+	{
+		MappedOutput mask;
+		if(failed || !mask.create(path, rows, cols, 1, 255))
+		{
+			return false;
+		}
+
+		for(int i = 0; i < (int)tiles.size(); i++)
+		{
+			tile& t = tiles[i];
+			if(!load(i))
+			{
+				mask.close();
+				return false;
+			}
+
+			for(int ly = 0; ly < t.h; ly++)
+			{
+				unsigned char* row = mask.row(t.y0 + ly) + t.x0;
+				for(int lx = 0; lx < t.w; lx++)
+				{
+					row[lx] = t.height[ly * t.w + lx] >= n ? 255 : 0;
+				}
+			}
+		}
+
+		return mask.close();
+	}
+
+private:
+	struct tile
+	{
+		int x0, y0, w, h;
+		bool isResident, onDisk;
+		bool active; // has a node with excess that can still reach the sink
+		bool pending; // inbox not applied yet
+		long long lastUse;
+
+		std::vector<capType> capacity[GridLayout::NUM_ARCS]; // local pixel index ly * w + lx; arcs leaving the tile included
+		std::vector<flowType> flow[GridLayout::NUM_ARCS];
+		std::vector<valueType> terminal; // residual link to the sink (< 0); source links are turned into excess
+		std::vector<valueType> excess;
+		std::vector<long long> height;
+
+		// per border slot (see slot()), always in memory
+		std::vector<long long> borderHeight;
+		std::vector<valueType> inboxExcess;
+		std::vector<valueType> inboxFlow[GridLayout::NUM_ARCS]; // flow change of the tile's own half of a crossing arc
+	};
+
+	int rows, cols;
+	long long n; // nodes of the graph: the height of pixels that cannot reach the sink
+	int tileSize, tilesX, tilesY;
+	int residentTiles, resident;
+	long long clock;
+	std::vector<tile> tiles;
+	FILE* spill; // NULL if it could not be created: fine as long as every tile fits in memory
+	off_t slotBytes;
+	bool failed; // a tile could not be spilled or read back: the flow is lost
+
+	int tileOf(int x, int y) const
+	{
+		return (y / tileSize) * tilesX + x / tileSize;
+	}
+
+	static int slot(const tile& t, int lx, int ly) // border slot of a local pixel, -1 inside
+	{
+		return ly == 0 ? lx : ly == t.h - 1 ? t.w + lx : lx == 0 ? 2 * t.w + ly : lx == t.w - 1 ? 2 * t.w + t.h + ly : -1;
+	}
+
+	template <typename T>
+	bool transfer(std::vector<T>& data, bool write) // false on a short write or read
+	{
+		if(write)
+		{
+			return fwrite(&data[0], sizeof(T), data.size(), spill) == data.size();
+		}
+		return fread(&data[0], sizeof(T), data.size(), spill) == data.size();
+	}
+
+	bool transferTile(tile& t, int i, bool write)
+	{
+		if(spill == NULL || fseeko(spill, (off_t)i * slotBytes, SEEK_SET) != 0)
+		{
+			return false;
+		}
+		bool complete = true;
+		for(int d = 0; d < GridLayout::NUM_ARCS; d++)
+		{
+			complete = complete && transfer(t.capacity[d], write) && transfer(t.flow[d], write);
+		}
+		complete = complete && transfer(t.terminal, write) && transfer(t.excess, write) && transfer(t.height, write);
+		return complete && (!write || fflush(spill) == 0); // a full disk may only show when the buffer is written
+	}
+
+	bool load(int i) // make tile i resident, spilling the least recently used tile if the budget is reached; false once a transfer failed
+	{
+		tile& t = tiles[i];
+		t.lastUse = ++clock;
+		if(failed)
+		{
+			return false;
+		}
+		if(t.isResident)
+		{
+			return true;
+		}
+
+		if(resident >= residentTiles)
+		{
+			int victim = -1;
+			for(int j = 0; j < (int)tiles.size(); j++)
+			{
+				if(tiles[j].isResident && (victim == -1 || tiles[j].lastUse < tiles[victim].lastUse))
+				{
+					victim = j;
+				}
+			}
+			tile& v = tiles[victim];
+			if(!transferTile(v, victim, true))
+			{
+				failed = true;
+				return false;
+			}
+			v.onDisk = true;
+			for(int d = 0; d < GridLayout::NUM_ARCS; d++)
+			{
+				std::vector<capType>().swap(v.capacity[d]);
+				std::vector<flowType>().swap(v.flow[d]);
+			}
+			std::vector<valueType>().swap(v.terminal);
+			std::vector<valueType>().swap(v.excess);
+			std::vector<long long>().swap(v.height);
+			v.isResident = false;
+			resident--;
+		}
+
+		int size = t.w * t.h;
+		for(int d = 0; d < GridLayout::NUM_ARCS; d++)
+		{
+			t.capacity[d].assign(size, 0);
+			t.flow[d].assign(size, 0);
+		}
+		t.terminal.assign(size, 0);
+		t.excess.assign(size, 0);
+		t.height.assign(size, n);
+		t.isResident = true;
+		resident++;
+		if(t.onDisk)
+		{
+			if(!transferTile(t, i, false))
+			{
+				failed = true;
+				return false;
+			}
+			loads++;
+		}
+		return true;
+	}
+
+	void applyInbox(tile& t) // flow pushed into the tile by its neighbours
+	{
+		if(!t.pending)
+		{
+			return;
+		}
+		for(int ly = 0; ly < t.h; ly++)
+		{
+			for(int lx = 0; lx < t.w; lx += (ly == 0 || ly == t.h - 1) ? 1 : std::max(t.w - 1, 1))
+			{
+				int s = slot(t, lx, ly), p = ly * t.w + lx;
+				t.excess[p] += t.inboxExcess[s];
+				t.inboxExcess[s] = 0;
+				for(int d = 0; d < GridLayout::NUM_ARCS; d++)
+				{
+					t.flow[d][p] += (flowType)t.inboxFlow[d][s];
+					t.inboxFlow[d][s] = 0;
+				}
+			}
+		}
+		t.pending = false;
+	}
+
+	void saveBorderHeights(tile& t, bool* changed)
+	{
+		for(int ly = 0; ly < t.h; ly++)
+		{
+			for(int lx = 0; lx < t.w; lx += (ly == 0 || ly == t.h - 1) ? 1 : std::max(t.w - 1, 1))
+			{
+				int s = slot(t, lx, ly);
+				long long h = t.height[ly * t.w + lx];
+				if(t.borderHeight[s] != h)
+				{
+					t.borderHeight[s] = h;
+					*changed = true;
+				}
+			}
+		}
+	}
+
+	bool crossing(const tile& t, int lx, int ly, int d) const // the arc leaves the tile
+	{
+		int nx = lx + GridLayout::dx(d), ny = ly + GridLayout::dy(d);
+		return nx < 0 || nx >= t.w || ny < 0 || ny >= t.h;
+	}
+
+	long long neighbourHeight(const tile& t, int lx, int ly, int d) const // height of the neighbour across the border, as last saved by its tile
+	{
+		int x = t.x0 + lx + GridLayout::dx(d), y = t.y0 + ly + GridLayout::dy(d);
+		const tile& other = tiles[tileOf(x, y)];
+		return other.borderHeight[slot(other, x - other.x0, y - other.y0)];
+	}
+
+	void regionDistances(tile& t, bool raiseOnly) // BFS from the sink links and from the border, given the neighbours' heights
+	{
+		typedef std::pair<long long, int> entry; // (distance, local pixel)
+		std::priority_queue<entry, std::vector<entry>, std::greater<entry> > queue;
+		int size = t.w * t.h;
+		std::vector<long long> dist(size, n);
+
+		for(int p = 0; p < size; p++)
+		{
+			int lx = p % t.w, ly = p / t.w;
+			long long best = traits::positive(-t.terminal[p]) ? 1 : n;
+			if(slot(t, lx, ly) != -1)
+			{
+				for(int d = 0; d < GridLayout::NUM_ARCS; d++)
+				{
+					if(t.capacity[d][p] > 0 && crossing(t, lx, ly, d) && traits::positive((valueType)t.capacity[d][p] - t.flow[d][p]))
+					{
+						long long h = neighbourHeight(t, lx, ly, d);
+						if(h < n)
+						{
+							best = std::min(best, h + 1);
+						}
+					}
+				}
+			}
+			if(best < n)
+			{
+				dist[p] = best;
+				queue.push(entry(best, p));
+			}
+		}
+
+		while(!queue.empty()) // p reaches q's distance + 1 if the arc from p to q is residual
+		{
+			entry e = queue.top();
+			queue.pop();
+			int q = e.second;
+			if(e.first != dist[q])
+			{
+				continue;
+			}
+			int lx = q % t.w, ly = q / t.w;
+			for(int d = 0; d < GridLayout::NUM_ARCS; d++)
+			{
+				if(t.capacity[d][q] == 0 || crossing(t, lx, ly, d))
+				{
+					continue;
+				}
+				int p = q + GridLayout::dy(d) * t.w + GridLayout::dx(d);
+				int r = GridLayout::reverse(d);
+				if(dist[p] > dist[q] + 1 && traits::positive((valueType)t.capacity[r][p] - t.flow[r][p]))
+				{
+					dist[p] = dist[q] + 1;
+					queue.push(entry(dist[p], p));
+				}
+			}
+		}
+
+		t.active = false;
+		for(int p = 0; p < size; p++)
+		{
+			t.height[p] = raiseOnly ? std::max(t.height[p], dist[p]) : dist[p];
+			if(traits::positive(t.excess[p]) && t.height[p] < n)
+			{
+				t.active = true;
+			}
+		}
+	}
+
+	void globalRelabel() // exact distances to the sink: tile-wise BFS until the border distances are stable
+	{
+		for(size_t i = 0; i < tiles.size(); i++)
+		{
+			std::fill(tiles[i].borderHeight.begin(), tiles[i].borderHeight.end(), n);
+		}
+
+		for(bool changed = true, forward = true; changed; forward = !forward)
+		{
+			changed = false;
+			for(int k = 0; k < (int)tiles.size(); k++)
+			{
+				int i = forward ? k : (int)tiles.size() - 1 - k; // alternate the sweep direction
+				if(!load(i))
+				{
+					return;
+				}
+				applyInbox(tiles[i]);
+				regionDistances(tiles[i], false);
+				saveBorderHeights(tiles[i], &changed);
+			}
+		}
+	}
+
+	void discharge(int i) // push-relabel inside tile i; pushes across the border go to the neighbours' inboxes
+	{
+		tile& t = tiles[i];
+		if(!load(i))
+		{
+			return;
+		}
+		applyInbox(t);
+
+		int size = t.w * t.h;
+		std::queue<int> queue;
+		std::vector<bool> queued(size, false);
+		for(int p = 0; p < size; p++)
+		{
+			if(traits::positive(t.excess[p]) && t.height[p] < n)
+			{
+				queue.push(p);
+				queued[p] = true;
+			}
+		}
+
+		int relabels = 0;
+		while(!queue.empty())
+		{
+			int p = queue.front();
+			queue.pop();
+			queued[p] = false;
+			int lx = p % t.w, ly = p / t.w;
+
+			while(traits::positive(t.excess[p]) && t.height[p] < n)
+			{
+				if(traits::positive(-t.terminal[p]) && t.height[p] == 1) // to the sink
+				{
+					valueType amount = std::min(t.excess[p], -t.terminal[p]);
+					t.terminal[p] += amount;
+					t.excess[p] -= amount;
+				}
+
+				for(int d = 0; d < GridLayout::NUM_ARCS && traits::positive(t.excess[p]); d++)
+				{
+					valueType residual = (valueType)t.capacity[d][p] - t.flow[d][p];
+					if(t.capacity[d][p] == 0 || !traits::positive(residual))
+					{
+						continue;
+					}
+
+					bool cross = crossing(t, lx, ly, d);
+					int q = p + GridLayout::dy(d) * t.w + GridLayout::dx(d);
+					long long h = cross ? neighbourHeight(t, lx, ly, d) : t.height[q];
+					if(t.height[p] != h + 1)
+					{
+						continue;
+					}
+
+					valueType amount = std::min(t.excess[p], residual);
+					t.flow[d][p] += (flowType)amount;
+					t.excess[p] -= amount;
+
+					if(cross)
+					{
+						int x = t.x0 + lx + GridLayout::dx(d), y = t.y0 + ly + GridLayout::dy(d);
+						tile& other = tiles[tileOf(x, y)];
+						int s = slot(other, x - other.x0, y - other.y0);
+						other.inboxFlow[GridLayout::reverse(d)][s] -= amount;
+						other.inboxExcess[s] += amount;
+						other.pending = true;
+					}
+					else
+					{
+						t.flow[GridLayout::reverse(d)][q] -= (flowType)amount;
+						t.excess[q] += amount;
+						if(!queued[q] && t.height[q] < n)
+						{
+							queue.push(q);
+							queued[q] = true;
+						}
+					}
+				}
+
+				if(!traits::positive(t.excess[p]))
+				{
+					break;
+				}
+
+				// relabel: every residual arc is inadmissible now
+				long long minHeight = traits::positive(-t.terminal[p]) ? 0 : n;
+				for(int d = 0; d < GridLayout::NUM_ARCS; d++)
+				{
+					if(t.capacity[d][p] > 0 && traits::positive((valueType)t.capacity[d][p] - t.flow[d][p]))
+					{
+						int q = p + GridLayout::dy(d) * t.w + GridLayout::dx(d);
+						minHeight = std::min(minHeight, crossing(t, lx, ly, d) ? neighbourHeight(t, lx, ly, d) : t.height[q]);
+					}
+				}
+				t.height[p] = std::min(minHeight + 1, n);
+
+				if(++relabels >= size) // heights only rise by one per relabel: jump them to the distances inside the tile
+				{
+					regionDistances(t, true);
+					relabels = 0;
+				}
+			}
+		}
+
+		t.active = false;
+		bool changed = false;
+		saveBorderHeights(t, &changed);
+	}
+};
+
+#endif
@@ -0,0 +1,109 @@
+#ifndef WEIGHT_MODELS_H
+#define WEIGHT_MODELS_H
+
+#include <vector>
+#include <algorithm>
+#include <stdlib.h>
+#include <math.h>
+
+// Edge capacity models for the max-flow graphs: weight(distance) of the edge between two pixels "distance" apart, where the
+// distance is the absolute intensity difference of gray pixels or the scaled Euclidean distance of colour pixels (0..255, see
+// edgeWeights.h). A model declares whether its weights are integers and their largest value, so that capacityFor picks the
+// capacity type; all models below give integers in 1..256, so they share the 16 bit capacities.
+//
+// A model is never evaluated per arc: WeightTable evaluates it once for each of the 256 distances before the graph is built, and
+// GridGraph::build() looks the capacities of a whole row of arcs up in it after one row kernel call, so every model builds the
+// graph at the same cost.
+
+struct intensityWeight // edge weight from the difference in grayscale intensity; higher weight implies less difference in intensities
+{
+	static const bool integral = true;
+	static const int maxWeight = 256;
+
+	int weight(int distance) const
+	{
+		return 256 - distance;
+	}
+};
+
+struct contrastWeight // Boykov and Jolly: exp(-distance^2 / 2 sigma^2), scaled to 1..256 so that every edge keeps an arc
+{
+	static const bool integral = true;
+	static const int maxWeight = 256;
+
+	double sigma;
+
+	contrastWeight(double sigma) : sigma(sigma) {}
+
+	int weight(int distance) const
+	{
+		return std::max(1, (int)lround(maxWeight * exp(-(double)distance * distance / (2 * sigma * sigma))));
+	}
+};
+
+template <typename capType>
+class WeightTable // capacities of a model for every distance, and the distance the graph is built from
+{
+public:
+	bool colour; // Euclidean distance of 3 channel pixels instead of the intensity difference
+	int maxWeight; // largest capacity in the table (for capacity scaling)
+	capType byDistance[256];
+
+	template <typename weightModel>
+	WeightTable(const weightModel& model, bool colour) : colour(colour), maxWeight(0)
+	{
+		for(int distance = 0; distance < 256; distance++)
+		{
+			byDistance[distance] = (capType)model.weight(distance);
+			maxWeight = std::max(maxWeight, (int)byDistance[distance]);
+		}
+	}
+
+	capType operator()(int a, int b) const // edge between two gray pixels
+	{
+		return byDistance[abs(a - b)];
+	}
+};
+
+// terminal (t-link) capacities from the intensity histograms of seed regions (Boykov and Jolly): a pixel of intensity i is linked
+// to the source with weight * -ln Pr(i | background) and to the sink with weight * -ln Pr(i | foreground). Only the difference
+// changes the cut, so the net link weight * ln(Pr(i | foreground) / Pr(i | background)) is kept, also as a table over the 256
+// intensities. Both histograms start at one count per intensity, so intensities no seed region has give finite links.
+
+class SeedHistograms
+{
+public:
+	SeedHistograms() : foreground(256, 1), background(256, 1), foregroundTotal(256), backgroundTotal(256) {}
+
+	// the pixels of the square of the given radius around a seed, clipped to the image
+	void addRegion(const unsigned char* gray, size_t step, int rows, int cols, int x, int y, int radius, int label)
+	{
+		std::vector<long long>& histogram = label > 0 ? foreground : background;
+		long long& total = label > 0 ? foregroundTotal : backgroundTotal;
+
+		for(int i = std::max(y - radius, 0); i <= std::min(y + radius, rows - 1); i++)
+		{
+			for(int j = std::max(x - radius, 0); j <= std::min(x + radius, cols - 1); j++)
+			{
+				histogram[gray[i * step + j]]++;
+				total++;
+			}
+		}
+	}
+
+	template <typename valueType>
+	void terminalTable(double weight, valueType* byIntensity) const // net terminal capacity for every intensity: > 0 to the source
+	{
+		for(int i = 0; i < 256; i++)
+		{
+			double ratio = log((double)foreground[i] / foregroundTotal) - log((double)background[i] / backgroundTotal);
+			byIntensity[i] = (valueType)lround(weight * ratio);
+		}
+	}
+
+private:
+	std::vector<long long> foreground, background;
+	long long foregroundTotal, backgroundTotal;
+};
+
+#endif